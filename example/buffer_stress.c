@@ -0,0 +1,193 @@
+/* hammer groove_buffer_ref and groove_buffer_unref from several threads */
+
+#include <groove/groove.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+// how many buffers the threads share at a time
+#define BATCH_SIZE 16
+
+struct Snapshot {
+    struct GrooveBuffer *buffer;
+    struct GroovePlaylistItem *item;
+    double pos;
+    int size;
+    unsigned int checksum;
+};
+
+struct Worker {
+    pthread_t thread_id;
+    int index;
+    int rounds;
+    struct Snapshot *batch;
+    int batch_count;
+    int errors;
+};
+
+static int usage(char *arg0) {
+    fprintf(stderr, "Usage: %s file [--threads 4] [--rounds 10000]\n", arg0);
+    return 1;
+}
+
+// covers every plane of planar audio, whose data[0] holds one channel
+static unsigned int checksum(struct GrooveBuffer *buffer) {
+    struct GrooveAudioFormat *format = &buffer->format;
+    int channels = groove_channel_layout_count(format->channel_layout);
+    int planar = format->sample_fmt >= GROOVE_SAMPLE_FMT_U8P;
+    int planes = planar ? channels : 1;
+    int plane_size = buffer->frame_count *
+        groove_sample_format_bytes_per_sample(format->sample_fmt) * (planar ? 1 : channels);
+    unsigned int sum = 0;
+    for (int plane = 0; plane < planes; plane += 1) {
+        for (int i = 0; i < plane_size; i += 1)
+            sum = sum * 31 + buffer->data[plane][i];
+    }
+    return sum;
+}
+
+// a buffer which went back to the pool too early is handed out again by
+// the decoder and no longer looks like it did when we got it
+static int snapshot_ok(struct Snapshot *snapshot) {
+    struct GrooveBuffer *buffer = snapshot->buffer;
+    return buffer->item == snapshot->item && buffer->pos == snapshot->pos &&
+        buffer->size == snapshot->size && checksum(buffer) == snapshot->checksum;
+}
+
+// each worker starts out owning one reference to every buffer in the batch
+// and drops it at the end, so the workers race for the last one too
+static void *worker_thread(void *arg) {
+    struct Worker *w = arg;
+    for (int i = 0; i < w->rounds; i += 1) {
+        struct Snapshot *snapshot = &w->batch[(w->index + i) % w->batch_count];
+        groove_buffer_ref(snapshot->buffer);
+        groove_buffer_ref(snapshot->buffer);
+        groove_buffer_unref(snapshot->buffer);
+        // checksums are slow; an occasional one is enough to notice
+        if (i % 64 == 0 && !snapshot_ok(snapshot))
+            w->errors += 1;
+        groove_buffer_unref(snapshot->buffer);
+    }
+    for (int i = 0; i < w->batch_count; i += 1) {
+        struct Snapshot *snapshot = &w->batch[(w->index + i) % w->batch_count];
+        if (!snapshot_ok(snapshot))
+            w->errors += 1;
+        groove_buffer_unref(snapshot->buffer);
+    }
+    return NULL;
+}
+
+int main(int argc, char * argv[]) {
+    char *filename = NULL;
+    int thread_count = 4;
+    int rounds = 10000;
+
+    for (int i = 1; i < argc; i += 1) {
+        char *arg = argv[i];
+        if (arg[0] == '-' && arg[1] == '-') {
+            arg += 2;
+            if (i + 1 >= argc) {
+                return usage(argv[0]);
+            } else if (strcmp(arg, "threads") == 0) {
+                thread_count = atoi(argv[++i]);
+            } else if (strcmp(arg, "rounds") == 0) {
+                rounds = atoi(argv[++i]);
+            } else {
+                return usage(argv[0]);
+            }
+        } else if (!filename) {
+            filename = arg;
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (!filename || thread_count < 1 || rounds < 1)
+        return usage(argv[0]);
+
+    groove_init();
+    atexit(groove_finish);
+    groove_set_logging(GROOVE_LOG_INFO);
+
+    struct GrooveFile *file = groove_file_open(filename);
+    if (!file) {
+        fprintf(stderr, "Error opening input file %s\n", filename);
+        return 1;
+    }
+    struct GroovePlaylist *playlist = groove_playlist_create();
+    struct GrooveSink *sink = groove_sink_create();
+    groove_file_audio_format(file, &sink->audio_format);
+    // keep the decoder busy refilling, so that its buffer pool recycles
+    // while the threads run
+    sink->buffer_size = 2 * BATCH_SIZE * 1024;
+    if (groove_sink_attach(sink, playlist) < 0) {
+        fprintf(stderr, "error attaching sink\n");
+        return 1;
+    }
+    groove_playlist_insert(playlist, file, 1.0, NULL);
+
+    struct Worker *workers = calloc(thread_count, sizeof(struct Worker));
+    if (!workers) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    struct Snapshot batch[BATCH_SIZE];
+    long buffer_count = 0;
+    int errors = 0;
+    int done = 0;
+    while (!done) {
+        int batch_count = 0;
+        while (batch_count < BATCH_SIZE) {
+            struct GrooveBuffer *buffer;
+            if (groove_sink_buffer_get(sink, &buffer, 1) != GROOVE_BUFFER_YES) {
+                done = 1;
+                break;
+            }
+            struct Snapshot *snapshot = &batch[batch_count++];
+            snapshot->buffer = buffer;
+            snapshot->item = buffer->item;
+            snapshot->pos = buffer->pos;
+            snapshot->size = buffer->size;
+            snapshot->checksum = checksum(buffer);
+        }
+        if (batch_count == 0)
+            break;
+
+        // one reference per worker. ours is the first of them
+        for (int i = 0; i < batch_count; i += 1) {
+            for (int j = 1; j < thread_count; j += 1)
+                groove_buffer_ref(batch[i].buffer);
+        }
+
+        for (int i = 0; i < thread_count; i += 1) {
+            struct Worker *w = &workers[i];
+            w->index = i;
+            w->rounds = rounds;
+            w->batch = batch;
+            w->batch_count = batch_count;
+            w->errors = 0;
+            if (pthread_create(&w->thread_id, NULL, worker_thread, w) != 0) {
+                fprintf(stderr, "unable to create thread\n");
+                return 1;
+            }
+        }
+        for (int i = 0; i < thread_count; i += 1) {
+            pthread_join(workers[i].thread_id, NULL);
+            errors += workers[i].errors;
+        }
+        buffer_count += batch_count;
+    }
+
+    printf("%ld buffers, %d threads, %d rounds each: %d errors\n",
+            buffer_count, thread_count, rounds, errors);
+
+    free(workers);
+    groove_sink_detach(sink);
+    groove_sink_destroy(sink);
+    groove_playlist_clear(playlist);
+    groove_playlist_destroy(playlist);
+    groove_file_close(file);
+
+    return errors > 0;
+}
@@ -31,7 +31,7 @@ int main(int argc, char * argv[]) {
     groove_init();
     atexit(groove_finish);
     groove_set_logging(GROOVE_LOG_INFO);
-    file = groove_file_open(filename);
+    file = groove_file_open_flags(filename, GROOVE_FILE_OPEN_METADATA_ONLY);
     if (!file) {
         fprintf(stderr, "error opening file\n");
         return 1;
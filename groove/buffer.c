@@ -8,13 +8,157 @@
 #include "buffer.h"
 
 #include <libavutil/mem.h>
+#include <string.h>
+
+static void buffer_free(struct GrooveBufferPrivate *b) {
+    if (b->is_packet && b->data) {
+        av_free(b->data);
+    } else if (b->frame) {
+        av_frame_free(&b->frame);
+    }
+    av_free(b);
+}
+
+static void pool_free(struct GrooveBufferPool *pool) {
+    pthread_mutex_destroy(&pool->mutex);
+    av_free(pool);
+}
+
+static void pool_unref(struct GrooveBufferPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->ref_count -= 1;
+    int free = pool->ref_count == 0;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (free)
+        pool_free(pool);
+}
+
+static void pool_release(struct GrooveBufferPool *pool, struct GrooveBufferPrivate *b) {
+    // the samples go back to whoever allocated them, which for decoded
+    // frames is the decoder's own pool. only the AVFrame is kept
+    if (b->frame)
+        av_frame_unref(b->frame);
+
+    pthread_mutex_lock(&pool->mutex);
+    int keep = pool->owner_alive && pool->free_count < pool->max_free;
+    if (keep) {
+        b->next_free = pool->free_head;
+        pool->free_head = b;
+        pool->free_count += 1;
+    }
+    pool->ref_count -= 1;
+    int free_pool = pool->ref_count == 0;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (!keep)
+        buffer_free(b);
+    if (free_pool)
+        pool_free(pool);
+}
+
+struct GrooveBufferPool *groove_buffer_pool_create(int max_free, int data_size) {
+    struct GrooveBufferPool *pool = av_mallocz(sizeof(struct GrooveBufferPool));
+    if (!pool)
+        return NULL;
+
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+        av_free(pool);
+        return NULL;
+    }
+
+    pool->max_free = max_free;
+    pool->data_size = data_size;
+    pool->ref_count = 1;
+    pool->owner_alive = 1;
+    return pool;
+}
+
+void groove_buffer_pool_destroy(struct GrooveBufferPool *pool) {
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->owner_alive = 0;
+    struct GrooveBufferPrivate *b = pool->free_head;
+    pool->free_head = NULL;
+    pool->free_count = 0;
+    pthread_mutex_unlock(&pool->mutex);
+
+    while (b) {
+        struct GrooveBufferPrivate *next = b->next_free;
+        buffer_free(b);
+        b = next;
+    }
+
+    pool_unref(pool);
+}
+
+struct GrooveBufferPrivate *groove_buffer_pool_get(struct GrooveBufferPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    struct GrooveBufferPrivate *b = pool->free_head;
+    if (b) {
+        pool->free_head = b->next_free;
+        pool->free_count -= 1;
+        pool->hits += 1;
+    } else {
+        pool->misses += 1;
+    }
+    pool->ref_count += 1;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (b) {
+        memset(&b->externals, 0, sizeof(struct GrooveBuffer));
+        b->next_free = NULL;
+    } else {
+        b = av_mallocz(sizeof(struct GrooveBufferPrivate));
+        if (!b) {
+            pool_unref(pool);
+            return NULL;
+        }
+        if (pool->data_size > 0) {
+            b->is_packet = 1;
+            b->data = av_malloc(pool->data_size);
+        } else {
+            b->frame = av_frame_alloc();
+        }
+        if (!b->frame && !b->data) {
+            av_free(b);
+            pool_unref(pool);
+            return NULL;
+        }
+    }
+
+    if (b->is_packet)
+        b->externals.data = &b->data;
+    b->pool = pool;
+    atomic_init(&b->ref_count, 1);
+    return b;
+}
+
+void groove_buffer_pool_set_max_free(struct GrooveBufferPool *pool, int max_free) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->max_free = max_free;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void groove_buffer_pool_stats(struct GrooveBufferPool *pool,
+        uint64_t *hits, uint64_t *misses)
+{
+    pthread_mutex_lock(&pool->mutex);
+    if (hits)
+        *hits = pool->hits;
+    if (misses)
+        *misses = pool->misses;
+    pthread_mutex_unlock(&pool->mutex);
+}
 
 void groove_buffer_ref(struct GrooveBuffer *buffer) {
     struct GrooveBufferPrivate *b = (struct GrooveBufferPrivate *) buffer;
 
-    pthread_mutex_lock(&b->mutex);
-    b->ref_count += 1;
-    pthread_mutex_unlock(&b->mutex);
+    // taking a new reference requires already holding one, so nothing needs
+    // to be ordered here
+    atomic_fetch_add_explicit(&b->ref_count, 1, memory_order_relaxed);
 }
 
 void groove_buffer_unref(struct GrooveBuffer *buffer) {
@@ -23,18 +167,13 @@ void groove_buffer_unref(struct GrooveBuffer *buffer) {
 
     struct GrooveBufferPrivate *b = (struct GrooveBufferPrivate *) buffer;
 
-    pthread_mutex_lock(&b->mutex);
-    b->ref_count -= 1;
-    int free = b->ref_count == 0;
-    pthread_mutex_unlock(&b->mutex);
-
-    if (free) {
-        pthread_mutex_destroy(&b->mutex);
-        if (b->is_packet && b->data) {
-            av_free(b->data);
-        } else if (b->frame) {
-            av_frame_free(&b->frame);
-        }
-        av_free(b);
+    // release so that our writes to the buffer happen before whichever
+    // thread drops the last reference frees it
+    if (atomic_fetch_sub_explicit(&b->ref_count, 1, memory_order_release) == 1) {
+        atomic_thread_fence(memory_order_acquire);
+        if (b->pool)
+            pool_release(b->pool, b);
+        else
+            buffer_free(b);
     }
 }
@@ -13,17 +13,57 @@
 #include <libavutil/frame.h>
 #include <libavcodec/avcodec.h>
 #include <pthread.h>
+#include <stdatomic.h>
+
+struct GrooveBufferPool;
 
 struct GrooveBufferPrivate {
     struct GrooveBuffer externals;
     AVFrame *frame;
     int is_packet;
-    int ref_count;
+    atomic_int ref_count;
 
-    pthread_mutex_t mutex;
     // used for when is_packet is true
     // GrooveBuffer::data[0] will point to this
     uint8_t *data;
+
+    // the pool this buffer returns to when the last reference is dropped.
+    // NULL if the buffer is freed instead.
+    struct GrooveBufferPool *pool;
+    struct GrooveBufferPrivate *next_free;
+};
+
+// recycles GrooveBufferPrivate structs along with their AVFrame, or their
+// data block for packet pools. the AVFrame is kept but not its sample data,
+// which is unreferenced when the buffer comes back. buffers from the pool
+// keep the pool alive, so it is safe for them to outlive the owner.
+struct GrooveBufferPool {
+    pthread_mutex_t mutex;
+    struct GrooveBufferPrivate *free_head;
+    int free_count;
+    // how many unused buffers to keep around
+    int max_free;
+    // if > 0, buffers are packets with a data block of this many bytes
+    // instead of an AVFrame
+    int data_size;
+    // one reference for the owner and one for every buffer handed out
+    int ref_count;
+    int owner_alive;
+
+    uint64_t hits;
+    uint64_t misses;
 };
 
+struct GrooveBufferPool *groove_buffer_pool_create(int max_free, int data_size);
+// drops the owner's reference. outstanding buffers are freed when unref'd.
+void groove_buffer_pool_destroy(struct GrooveBufferPool *pool);
+
+// returns a buffer with a ref count of 1 and either an empty AVFrame or, for
+// packet pools, data[0] pointing to data_size bytes. NULL if out of memory.
+struct GrooveBufferPrivate *groove_buffer_pool_get(struct GrooveBufferPool *pool);
+
+void groove_buffer_pool_set_max_free(struct GrooveBufferPool *pool, int max_free);
+void groove_buffer_pool_stats(struct GrooveBufferPool *pool,
+        uint64_t *hits, uint64_t *misses);
+
 #endif /* GROOVE_BUFFER_H_INCLUDED */
@@ -46,8 +46,12 @@ struct GrooveEncoderPrivate {
 
     pthread_t thread_id;
 
+    // the muxer writes into the avio context's own buffer, which stays put
+    // for the life of the context because avio keeps pointers into it. each
+    // flush is copied into a chunk from chunk_pool, so there is no allocation
+    // per flush.
     AVIOContext *avio;
-    unsigned char *avio_buf;
+    struct GrooveBufferPool *chunk_pool;
 
     int sent_header;
     char strbuf[512];
@@ -232,44 +236,39 @@ static void audioq_get(struct GrooveQueue *queue, void *obj) {
         pthread_cond_signal(&e->drain_cond);
 }
 
+static void audioq_get_many(struct GrooveQueue *queue, void **objs, int count) {
+    struct GrooveEncoderPrivate *e = queue->context;
+    struct GrooveEncoder *encoder = &e->externals;
+
+    for (int i = 0; i < count; i += 1) {
+        struct GrooveBuffer *buffer = objs[i];
+        if (buffer != end_of_q_sentinel)
+            e->audioq_size -= buffer->size;
+    }
+
+    if (e->audioq_size < encoder->encoded_buffer_size)
+        pthread_cond_signal(&e->drain_cond);
+}
+
+// avio only ever flushes its own buffer, which is encoded_chunk_size bytes,
+// so each flush fits in one chunk and either all of it is queued or none
 static int encoder_write_packet(void *opaque, uint8_t *buf, int buf_size) {
     struct GrooveEncoderPrivate *e = opaque;
 
-    struct GrooveBufferPrivate *b = av_mallocz(sizeof(struct GrooveBufferPrivate));
-
+    struct GrooveBufferPrivate *b = groove_buffer_pool_get(e->chunk_pool);
     if (!b) {
         av_log(NULL, AV_LOG_ERROR, "unable to allocate buffer\n");
         return -1;
     }
-
     struct GrooveBuffer *buffer = &b->externals;
 
-    if (pthread_mutex_init(&b->mutex, NULL) != 0) {
-        av_free(b);
-        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
-        return -1;
-    }
+    memcpy(b->data, buf, buf_size);
 
     buffer->item = e->encode_head;
     buffer->pos = e->encode_pos;
     buffer->format = e->encode_format;
-
-    b->is_packet = 1;
-    b->data = av_malloc(buf_size);
-    if (!b->data) {
-        av_free(buffer);
-        av_free(b);
-        pthread_mutex_destroy(&b->mutex);
-        av_log(NULL, AV_LOG_ERROR, "unable to create data buffer\n");
-        return -1;
-    }
-    memcpy(b->data, buf, buf_size);
-
-    buffer->data = &b->data;
     buffer->size = buf_size;
 
-    b->ref_count = 1;
-
     groove_queue_put(e->audioq, buffer);
 
     return 0;
@@ -284,22 +283,6 @@ struct GrooveEncoder *groove_encoder_create(void) {
     }
     struct GrooveEncoder *encoder = &e->externals;
 
-    const int buffer_size = 4 * 1024;
-    e->avio_buf = av_malloc(buffer_size);
-    if (!e->avio_buf) {
-        groove_encoder_destroy(encoder);
-        av_log(NULL, AV_LOG_ERROR, "unable to allocate avio buffer\n");
-        return NULL;
-    }
-
-    e->avio = avio_alloc_context(e->avio_buf, buffer_size, 1, encoder, NULL,
-            encoder_write_packet, NULL);
-    if (!e->avio) {
-        groove_encoder_destroy(encoder);
-        av_log(NULL, AV_LOG_ERROR, "unable to allocate avio context\n");
-        return NULL;
-    }
-
     if (pthread_mutex_init(&e->encode_head_mutex, NULL) != 0) {
         groove_encoder_destroy(encoder);
         av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
@@ -324,6 +307,7 @@ struct GrooveEncoder *groove_encoder_create(void) {
     e->audioq->cleanup = audioq_cleanup;
     e->audioq->put = audioq_put;
     e->audioq->get = audioq_get;
+    e->audioq->get_many = audioq_get_many;
     e->audioq->purge = audioq_purge;
 
     e->sink = groove_sink_create();
@@ -344,6 +328,7 @@ struct GrooveEncoder *groove_encoder_create(void) {
     encoder->target_audio_format.channel_layout = GROOVE_CH_LAYOUT_STEREO;
     encoder->sink_buffer_size = e->sink->buffer_size;
     encoder->encoded_buffer_size = 16 * 1024;
+    encoder->encoded_chunk_size = 8 * 1024;
 
     return encoder;
 }
@@ -363,12 +348,6 @@ void groove_encoder_destroy(struct GrooveEncoder *encoder) {
     if (e->drain_cond_inited)
         pthread_cond_destroy(&e->drain_cond);
 
-    if (e->avio)
-        av_free(e->avio);
-
-    if (e->avio_buf)
-        av_free(e->avio_buf);
-
     if (e->metadata)
         av_dict_free(&e->metadata);
 
@@ -494,9 +473,38 @@ static void log_audio_fmt(const struct GrooveAudioFormat *fmt) {
 int groove_encoder_attach(struct GrooveEncoder *encoder, struct GroovePlaylist *playlist) {
     struct GrooveEncoderPrivate *e = (struct GrooveEncoderPrivate *) encoder;
 
+    if (encoder->encoded_chunk_size <= 0) {
+        av_log(NULL, AV_LOG_ERROR, "encoded_chunk_size must be positive\n");
+        return -1;
+    }
+
     encoder->playlist = playlist;
     groove_queue_reset(e->audioq);
 
+    // enough chunks to fill the encoded buffer queue plus the one that a
+    // flush is being copied into
+    int chunk_count = encoder->encoded_buffer_size / encoder->encoded_chunk_size + 2;
+    e->chunk_pool = groove_buffer_pool_create(chunk_count, encoder->encoded_chunk_size);
+    if (!e->chunk_pool) {
+        groove_encoder_detach(encoder);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate buffer pool\n");
+        return -1;
+    }
+    unsigned char *avio_buf = av_malloc(encoder->encoded_chunk_size);
+    if (!avio_buf) {
+        groove_encoder_detach(encoder);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate avio buffer\n");
+        return -1;
+    }
+    e->avio = avio_alloc_context(avio_buf, encoder->encoded_chunk_size,
+            1, encoder, NULL, encoder_write_packet, NULL);
+    if (!e->avio) {
+        av_free(avio_buf);
+        groove_encoder_detach(encoder);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate avio context\n");
+        return -1;
+    }
+
     e->fmt_ctx = avformat_alloc_context();
     if (!e->fmt_ctx) {
         groove_encoder_detach(encoder);
@@ -610,8 +618,18 @@ int groove_encoder_detach(struct GrooveEncoder *encoder) {
         e->stream = NULL;
     }
 
-    if (e->fmt_ctx)
+    if (e->fmt_ctx) {
         avformat_free_context(e->fmt_ctx);
+        e->fmt_ctx = NULL;
+    }
+
+    if (e->avio) {
+        av_free(e->avio->buffer);
+        av_free(e->avio);
+        e->avio = NULL;
+    }
+    groove_buffer_pool_destroy(e->chunk_pool);
+    e->chunk_pool = NULL;
 
     e->encode_head = NULL;
     e->encode_pos = -1.0;
@@ -641,6 +659,16 @@ int groove_encoder_buffer_get(struct GrooveEncoder *encoder,
     }
 }
 
+int groove_encoder_buffer_get_many(struct GrooveEncoder *encoder,
+        struct GrooveBuffer **buffers, int max, int block)
+{
+    struct GrooveEncoderPrivate *e = (struct GrooveEncoderPrivate *) encoder;
+
+    // end_of_q_sentinel is NULL so it comes through as a NULL entry
+    int count = groove_queue_get_many(e->audioq, (void**)buffers, max, block);
+    return count < 0 ? 0 : count;
+}
+
 struct GrooveTag *groove_encoder_metadata_get(struct GrooveEncoder *encoder, const char *key,
         const struct GrooveTag *prev, int flags)
 {
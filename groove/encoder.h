@@ -73,6 +73,15 @@ struct GrooveEncoder {
      * not be.
      */
     struct GrooveAudioFormat actual_audio_format;
+
+    /* the size in bytes of the GrooveBuffers you get from
+     * groove_encoder_buffer_get. larger chunks mean fewer buffers but more
+     * latency before one is ready.
+     * format headers and trailers may come in smaller buffers.
+     * must be positive, or groove_encoder_attach fails.
+     * groove_encoder_create defaults this to 8192
+     */
+    int encoded_chunk_size;
 };
 
 struct GrooveEncoder *groove_encoder_create(void);
@@ -95,6 +104,10 @@ int groove_encoder_detach(struct GrooveEncoder *encoder);
 int groove_encoder_buffer_get(struct GrooveEncoder *encoder,
         struct GrooveBuffer **buffer, int block);
 
+/* see docs for groove_sink_buffer_get_many */
+int groove_encoder_buffer_get_many(struct GrooveEncoder *encoder,
+        struct GrooveBuffer **buffers, int max, int block);
+
 /* returns < 0 on error, 0 on no buffer ready, 1 on buffer ready
  * if block is 1, block until buffer is ready
  */
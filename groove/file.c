@@ -6,16 +6,186 @@
  */
 
 #include "file.h"
+#include "probecache.h"
+#include "gapless.h"
+#include "tags.h"
 
 #include <libavutil/mem.h>
+#include <libavutil/avstring.h>
+#include <libavutil/mathematics.h>
 #include <libavutil/channel_layout.h>
 
+#include <fcntl.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IO_BUFFER_SIZE (32 * 1024)
+#define MAP_READ_AHEAD (1024 * 1024)
+
+// probing limits for GROOVE_FILE_OPEN_METADATA_ONLY and for files found in
+// the probe cache. audio headers are
+// small; the defaults are sized for finding streams in muxed video.
+#define METADATA_PROBE_SIZE (64 * 1024)
+#define METADATA_ANALYZE_DURATION (AV_TIME_BASE / 2)
+
+#define DEFAULT_TAG_PADDING 4096
+
+// seconds of audio between the points of a seek index. seeks decode and
+// drop up to this much, which is cheap next to the memory one point per
+// packet would take for long files.
+#define SEEK_INDEX_INTERVAL 0.1
+
 static int decode_interrupt_cb(void *ctx) {
     struct GrooveFilePrivate *f = ctx;
     return f ? f->abort_request : 0;
 }
 
-struct GrooveFile *groove_file_open(char *filename) {
+static void mem_advise_ahead(struct GrooveMemInput *mem) {
+    if (mem->advised >= mem->size || mem->pos + MAP_READ_AHEAD / 2 < mem->advised)
+        return;
+    // madvise wants a page aligned start address
+    int64_t page_size = sysconf(_SC_PAGESIZE);
+    int64_t start = mem->pos & ~(page_size - 1);
+    int64_t end = FFMIN(mem->pos + MAP_READ_AHEAD, mem->size);
+    madvise((void *)(mem->data + start), end - start, MADV_WILLNEED);
+    mem->advised = end;
+}
+
+static int mem_read(void *opaque, uint8_t *buf, int buf_size) {
+    struct GrooveMemInput *mem = opaque;
+    int64_t left = mem->size - mem->pos;
+    if (left <= 0)
+        return AVERROR_EOF;
+    int size = FFMIN(buf_size, left);
+    if (mem->mapped)
+        mem_advise_ahead(mem);
+    memcpy(buf, mem->data + mem->pos, size);
+    mem->pos += size;
+    return size;
+}
+
+static int64_t mem_seek(void *opaque, int64_t offset, int whence) {
+    struct GrooveMemInput *mem = opaque;
+    int64_t pos;
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return mem->size;
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = mem->pos + offset;
+            break;
+        case SEEK_END:
+            pos = mem->size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (pos < 0 || pos > mem->size)
+        return AVERROR(EINVAL);
+    if (pos != mem->pos) {
+        mem->pos = pos;
+        // restart read-ahead from the new position
+        mem->advised = pos;
+    }
+    return pos;
+}
+
+static int custom_read(void *opaque, uint8_t *buf, int buf_size) {
+    struct GrooveFilePrivate *f = opaque;
+    int ret = f->custom_read(f->custom_opaque, buf, buf_size);
+    return ret == 0 ? AVERROR_EOF : ret;
+}
+
+static int64_t custom_seek(void *opaque, int64_t offset, int whence) {
+    struct GrooveFilePrivate *f = opaque;
+    // callers only see SEEK_SET, SEEK_CUR, SEEK_END and GROOVE_SEEK_SIZE,
+    // which has the same value as AVSEEK_SIZE
+    return f->custom_seek(f->custom_opaque, offset, whence & ~AVSEEK_FORCE);
+}
+
+static AVIOContext *alloc_avio(void *opaque,
+        int (*read_packet)(void *opaque, uint8_t *buf, int buf_size),
+        int64_t (*seek)(void *opaque, int64_t offset, int whence))
+{
+    uint8_t *buffer = av_malloc(IO_BUFFER_SIZE);
+    if (!buffer)
+        return NULL;
+    AVIOContext *avio = avio_alloc_context(buffer, IO_BUFFER_SIZE, 0, opaque, read_packet, NULL, seek);
+    if (!avio)
+        av_free(buffer);
+    return avio;
+}
+
+static void free_avio(AVIOContext *avio) {
+    if (avio) {
+        av_free(avio->buffer);
+        av_free(avio);
+    }
+}
+
+static int init_avio(struct GrooveFilePrivate *f, void *opaque,
+        int (*read_packet)(void *opaque, uint8_t *buf, int buf_size),
+        int64_t (*seek)(void *opaque, int64_t offset, int whence))
+{
+    f->avio = alloc_avio(opaque, read_packet, seek);
+    if (!f->avio)
+        return -1;
+    f->ic->pb = f->avio;
+    return 0;
+}
+
+// maps filename and points f->ic at it. returns < 0 if the file cannot be
+// mapped, in which case the caller should use the default protocol.
+static int open_map(struct GrooveFilePrivate *f, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    f->mem.data = map;
+    f->mem.size = st.st_size;
+    f->mem.pos = 0;
+    f->mem.mapped = 1;
+    f->mem.advised = 0;
+    return init_avio(f, &f->mem, mem_read, mem_seek);
+}
+
+static void close_avio(struct GrooveFilePrivate *f) {
+    free_avio(f->avio);
+    f->avio = NULL;
+    if (f->mem.mapped) {
+        munmap((void *)f->mem.data, f->mem.size);
+        f->mem.mapped = 0;
+    }
+    f->mem.data = NULL;
+}
+
+static int alloc_format_context(struct GrooveFilePrivate *f) {
+    f->ic = avformat_alloc_context();
+    if (!f->ic) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate format context\n");
+        return -1;
+    }
+    f->ic->interrupt_callback.callback = decode_interrupt_cb;
+    f->ic->interrupt_callback.opaque = f;
+    return 0;
+}
+
+static struct GrooveFilePrivate *alloc_file(const char *filename) {
     struct GrooveFilePrivate *f = av_mallocz(sizeof(struct GrooveFilePrivate));
     if (!f) {
         av_log(NULL, AV_LOG_ERROR, "unable to allocate file context\n");
@@ -25,6 +195,13 @@ struct GrooveFile *groove_file_open(char *filename) {
 
     f->audio_stream_index = -1;
     f->seek_pos = -1;
+    f->scanned_duration = -1.0;
+    f->seek_target = -1.0;
+    f->gapless_start = -INFINITY;
+    f->gapless_end = INFINITY;
+    av_strlcpy(f->filename, filename, sizeof(f->filename));
+    file->filename = f->filename;
+    file->tag_padding = DEFAULT_TAG_PADDING;
 
     if (pthread_mutex_init(&f->seek_mutex, NULL) != 0) {
         av_free(f);
@@ -32,27 +209,200 @@ struct GrooveFile *groove_file_open(char *filename) {
         return NULL;
     }
 
-    f->ic = avformat_alloc_context();
-    if (!f->ic) {
+    if (alloc_format_context(f) < 0) {
         groove_file_close(file);
-        av_log(NULL, AV_LOG_ERROR, "unable to allocate format context\n");
         return NULL;
     }
-    file->filename = f->ic->filename;
-    f->ic->interrupt_callback.callback = decode_interrupt_cb;
-    f->ic->interrupt_callback.opaque = file;
-    int err = avformat_open_input(&f->ic, filename, NULL, NULL);
+    return f;
+}
+
+// find out how much of the decoded audio is encoder delay and padding
+static void read_gapless_info(struct GrooveFilePrivate *f) {
+    AVStream *st = f->audio_st;
+    AVCodecContext *avctx = st->codec;
+    struct GrooveGapless gapless;
+    if (avctx->sample_rate <= 0 || !groove_gapless_read(f->ic, st, f->ic->pb, &gapless))
+        return;
+
+    double start = st->start_time != AV_NOPTS_VALUE ?
+        st->start_time * av_q2d(st->time_base) : 0.0;
+    // the ogg demuxer has already moved the timestamps of Opus back by the
+    // pre-skip, so that the delay ends at the start time
+    if (avctx->codec_id != AV_CODEC_ID_OPUS)
+        start += gapless.delay / (double)avctx->sample_rate;
+    f->gapless_start = start;
+    // without the length of the audio there is no telling where the
+    // padding starts
+    if (gapless.sample_count >= 0)
+        f->gapless_end = start + gapless.sample_count / (double)avctx->sample_rate;
+}
+
+static int open_decoder(struct GrooveFilePrivate *f) {
+    AVCodecContext *avctx = f->audio_st->codec;
+
+    if (avcodec_is_open(avctx))
+        return 0;
+
+    // decoded frames own a reference to their data, so the playlist can
+    // pass them on without a copy and trim them once they are writable
+    avctx->refcounted_frames = 1;
+    if (avcodec_open2(avctx, f->decoder, NULL) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to open decoder\n");
+        return -1;
+    }
+    read_gapless_info(f);
+    return 0;
+}
+
+static void save_probe_info(struct GrooveFilePrivate *f) {
+    AVCodecContext *avctx = f->audio_st->codec;
+    struct GrooveProbeInfo info = {
+        .format_name = (char *) f->ic->iformat->name,
+        .stream_index = f->audio_stream_index,
+        .codec_id = avctx->codec_id,
+        .sample_rate = avctx->sample_rate,
+        .channels = avctx->channels,
+        .channel_layout = avctx->channel_layout,
+        .sample_fmt = avctx->sample_fmt,
+        .bit_rate = avctx->bit_rate,
+        .block_align = avctx->block_align,
+        .bits_per_coded_sample = avctx->bits_per_coded_sample,
+        .frame_size = avctx->frame_size,
+        .time_base_num = f->audio_st->time_base.num,
+        .time_base_den = f->audio_st->time_base.den,
+        .start_time = f->audio_st->start_time,
+        .duration = f->audio_st->duration,
+        .extradata = avctx->extradata,
+        .extradata_size = avctx->extradata_size,
+        .metadata = f->ic->metadata,
+    };
+    groove_probe_cache_store(f->filename, &info);
+}
+
+// fills in the codec parameters of the audio stream from the probe cache
+// where the demuxer left them unset, so that avformat_find_stream_info
+// has little left to find. returns < 0 if info does not fit the opened
+// file.
+static int apply_probe_info(struct GrooveFilePrivate *f, const struct GrooveProbeInfo *info) {
+    if (info->stream_index < 0 || info->stream_index >= f->ic->nb_streams)
+        return -1;
+    AVStream *st = f->ic->streams[info->stream_index];
+    AVCodecContext *avctx = st->codec;
+    if (avctx->codec_type != AVMEDIA_TYPE_AUDIO || avctx->codec_id != info->codec_id)
+        return -1;
+    f->decoder = avcodec_find_decoder(avctx->codec_id);
+    if (!f->decoder)
+        return -1;
+
+    if (!avctx->sample_rate)
+        avctx->sample_rate = info->sample_rate;
+    if (!avctx->channels)
+        avctx->channels = info->channels;
+    if (!avctx->channel_layout)
+        avctx->channel_layout = info->channel_layout;
+    if (avctx->sample_fmt == AV_SAMPLE_FMT_NONE)
+        avctx->sample_fmt = info->sample_fmt;
+    if (!avctx->bit_rate)
+        avctx->bit_rate = info->bit_rate;
+    if (!avctx->block_align)
+        avctx->block_align = info->block_align;
+    if (!avctx->bits_per_coded_sample)
+        avctx->bits_per_coded_sample = info->bits_per_coded_sample;
+    if (!avctx->frame_size)
+        avctx->frame_size = info->frame_size;
+    if (!avctx->extradata && info->extradata_size > 0) {
+        avctx->extradata = av_mallocz(info->extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!avctx->extradata)
+            return -1;
+        memcpy(avctx->extradata, info->extradata, info->extradata_size);
+        avctx->extradata_size = info->extradata_size;
+    }
+
+    AVRational time_base = { info->time_base_num, info->time_base_den };
+    if (st->start_time == AV_NOPTS_VALUE && info->start_time != AV_NOPTS_VALUE)
+        st->start_time = av_rescale_q(info->start_time, time_base, st->time_base);
+    if (st->duration == AV_NOPTS_VALUE && info->duration != AV_NOPTS_VALUE)
+        st->duration = av_rescale_q(info->duration, time_base, st->time_base);
+
+    f->audio_stream_index = info->stream_index;
+    return 0;
+}
+
+// builds a stand-in format context from the probe cache without opening
+// the file. it answers metadata and format queries; open_stub_input
+// replaces it with the real thing before any decoding or saving.
+static int open_stub(struct GrooveFilePrivate *f, const struct GrooveProbeInfo *info) {
+    AVInputFormat *fmt = av_find_input_format(info->format_name);
+    AVCodec *decoder = avcodec_find_decoder(info->codec_id);
+    if (!fmt || !decoder || info->stream_index < 0)
+        return -1;
+
+    for (int i = 0; i <= info->stream_index; i += 1) {
+        AVStream *st = avformat_new_stream(f->ic, NULL);
+        if (!st)
+            return -1;
+        st->discard = AVDISCARD_ALL;
+    }
+    AVStream *st = f->ic->streams[info->stream_index];
+    AVCodecContext *avctx = st->codec;
+    avctx->codec_type = AVMEDIA_TYPE_AUDIO;
+    avctx->codec_id = info->codec_id;
+    avctx->sample_rate = info->sample_rate;
+    avctx->channels = info->channels;
+    avctx->channel_layout = info->channel_layout;
+    avctx->sample_fmt = info->sample_fmt;
+    st->time_base.num = info->time_base_num;
+    st->time_base.den = info->time_base_den;
+    st->start_time = info->start_time;
+    st->duration = info->duration;
+    av_dict_copy(&f->ic->metadata, info->metadata, 0);
+
+    f->ic->iformat = fmt;
+    av_strlcpy(f->ic->filename, f->filename, sizeof(f->ic->filename));
+    f->decoder = decoder;
+    f->audio_stream_index = info->stream_index;
+    f->audio_st = st;
+    f->audio_st->discard = AVDISCARD_DEFAULT;
+    f->stub = 1;
+    return 0;
+}
+
+// opens the input set up by alloc_file and, optionally, a custom avio.
+// filename is empty for inputs which do not come from the file system.
+// info is the probe cache entry for the file, or NULL.
+static int open_input(struct GrooveFilePrivate *f, const char *filename,
+        int flags, const struct GrooveProbeInfo *info)
+{
+    const char *name = filename[0] ? filename : "custom input";
+
+    // a cached format name saves probing for the format, and with the codec
+    // parameters known up front stream analysis only has to read far
+    // enough to find the first timestamps
+    AVInputFormat *fmt = info ? av_find_input_format(info->format_name) : NULL;
+
+    if (flags & GROOVE_FILE_OPEN_METADATA_ONLY) {
+        f->ic->probesize = METADATA_PROBE_SIZE;
+        f->ic->max_analyze_duration = METADATA_ANALYZE_DURATION;
+    }
+
+    // the filename is still passed along for format probing and so that
+    // ic->filename is set for groove_file_save
+    int err = avformat_open_input(&f->ic, filename, fmt, NULL);
     if (err < 0) {
-        groove_file_close(file);
-        av_log(NULL, AV_LOG_INFO, "%s: unrecognized format\n", filename);
-        return NULL;
+        av_log(NULL, AV_LOG_INFO, "%s: unrecognized format\n", name);
+        return -1;
+    }
+
+    int cached = fmt && apply_probe_info(f, info) >= 0;
+    if (cached) {
+        f->ic->probesize = METADATA_PROBE_SIZE;
+        f->ic->max_analyze_duration = METADATA_ANALYZE_DURATION;
     }
 
     err = avformat_find_stream_info(f->ic, NULL);
     if (err < 0) {
-        groove_file_close(file);
-        av_log(NULL, AV_LOG_ERROR, "%s: could not find codec parameters\n", filename);
-        return NULL;
+        av_log(NULL, AV_LOG_ERROR, "%s: could not find codec parameters\n", name);
+        return -1;
     }
 
     // set all streams to discard. in a few lines here we will find the audio
@@ -60,18 +410,17 @@ struct GrooveFile *groove_file_open(char *filename) {
     for (int i = 0; i < f->ic->nb_streams; i++)
         f->ic->streams[i]->discard = AVDISCARD_ALL;
 
-    f->audio_stream_index = av_find_best_stream(f->ic, AVMEDIA_TYPE_AUDIO, -1, -1, &f->decoder, 0);
+    if (!cached)
+        f->audio_stream_index = av_find_best_stream(f->ic, AVMEDIA_TYPE_AUDIO, -1, -1, &f->decoder, 0);
 
     if (f->audio_stream_index < 0) {
-        groove_file_close(file);
-        av_log(NULL, AV_LOG_INFO, "%s: no audio stream found\n", filename);
-        return NULL;
+        av_log(NULL, AV_LOG_INFO, "%s: no audio stream found\n", name);
+        return -1;
     }
 
     if (!f->decoder) {
-        groove_file_close(file);
-        av_log(NULL, AV_LOG_ERROR, "%s: no decoder found\n", filename);
-        return NULL;
+        av_log(NULL, AV_LOG_ERROR, "%s: no decoder found\n", name);
+        return -1;
     }
 
     f->audio_st = f->ic->streams[f->audio_stream_index];
@@ -79,18 +428,21 @@ struct GrooveFile *groove_file_open(char *filename) {
 
     AVCodecContext *avctx = f->audio_st->codec;
 
-    if (avcodec_open2(avctx, f->decoder, NULL) < 0) {
-        groove_file_close(file);
-        av_log(NULL, AV_LOG_ERROR, "unable to open decoder\n");
-        return NULL;
-    }
+    if (!(flags & GROOVE_FILE_OPEN_METADATA_ONLY) && open_decoder(f) < 0)
+        return -1;
 
     if (!avctx->channel_layout)
         avctx->channel_layout = av_get_default_channel_layout(avctx->channels);
     if (!avctx->channel_layout) {
-        groove_file_close(file);
         av_log(NULL, AV_LOG_ERROR, "unable to guess channel layout\n");
-        return NULL;
+        return -1;
+    }
+
+    if (cached) {
+        // the cached metadata already has the stream metadata merged in
+        av_dict_free(&f->ic->metadata);
+        av_dict_copy(&f->ic->metadata, info->metadata, 0);
+        return 0;
     }
 
     // copy the audio stream metadata to the context metadata
@@ -99,7 +451,130 @@ struct GrooveFile *groove_file_open(char *filename) {
         av_dict_set(&f->ic->metadata, tag->key, tag->value, AV_DICT_IGNORE_SUFFIX);
     }
 
-    return file;
+    if (filename[0])
+        save_probe_info(f);
+
+    return 0;
+}
+
+static int open_file_input(struct GrooveFilePrivate *f, int flags) {
+    struct GrooveProbeInfo info;
+    int cached = groove_probe_cache_lookup(f->filename, &info);
+
+    if (cached && (flags & GROOVE_FILE_OPEN_METADATA_ONLY)) {
+        int err = open_stub(f, &info);
+        if (err >= 0) {
+            groove_probe_info_free(&info);
+            return 0;
+        }
+        // start over with a clean format context
+        avformat_free_context(f->ic);
+        f->audio_st = NULL;
+        f->audio_stream_index = -1;
+        if (alloc_format_context(f) < 0) {
+            groove_probe_info_free(&info);
+            return -1;
+        }
+    }
+
+    if ((flags & GROOVE_FILE_OPEN_MMAP) && open_map(f, f->filename) < 0) {
+        close_avio(f);
+        f->ic->pb = NULL;
+        av_log(NULL, AV_LOG_VERBOSE, "%s: unable to map file, using default I/O\n", f->filename);
+    }
+
+    int err = open_input(f, f->filename, flags, cached ? &info : NULL);
+    if (cached)
+        groove_probe_info_free(&info);
+    return err;
+}
+
+// replaces the stand-in from open_stub with the real file, keeping any
+// metadata changes made in the meantime
+static int open_stub_input(struct GrooveFilePrivate *f) {
+    if (!f->stub)
+        return 0;
+
+    AVDictionary *metadata = f->ic->metadata;
+    f->ic->metadata = NULL;
+    avformat_free_context(f->ic);
+    f->stub = 0;
+    f->audio_st = NULL;
+    f->audio_stream_index = -1;
+
+    if (alloc_format_context(f) < 0 ||
+        open_file_input(f, f->open_flags & ~GROOVE_FILE_OPEN_METADATA_ONLY) < 0)
+    {
+        av_dict_free(&metadata);
+        return -1;
+    }
+    av_dict_free(&f->ic->metadata);
+    f->ic->metadata = metadata;
+    return 0;
+}
+
+struct GrooveFile *groove_file_open(char *filename) {
+    return groove_file_open_flags(filename, 0);
+}
+
+struct GrooveFile *groove_file_open_flags(char *filename, int flags) {
+    struct GrooveFilePrivate *f = alloc_file(filename);
+    if (!f)
+        return NULL;
+    f->open_flags = flags;
+    if (open_file_input(f, flags) < 0) {
+        groove_file_close(&f->externals);
+        return NULL;
+    }
+    return &f->externals;
+}
+
+struct GrooveFile *groove_file_open_memory(const void *data, int64_t size) {
+    struct GrooveFilePrivate *f = alloc_file("");
+    if (!f)
+        return NULL;
+    f->mem.data = data;
+    f->mem.size = size;
+    if (init_avio(f, &f->mem, mem_read, mem_seek) < 0) {
+        groove_file_close(&f->externals);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate I/O context\n");
+        return NULL;
+    }
+    if (open_input(f, "", 0, NULL) < 0) {
+        groove_file_close(&f->externals);
+        return NULL;
+    }
+    return &f->externals;
+}
+
+struct GrooveFile *groove_file_open_custom(
+        int (*read)(void *opaque, uint8_t *buf, int buf_size),
+        int64_t (*seek)(void *opaque, int64_t offset, int whence),
+        void *opaque)
+{
+    struct GrooveFilePrivate *f = alloc_file("");
+    if (!f)
+        return NULL;
+    f->custom_read = read;
+    f->custom_seek = seek;
+    f->custom_opaque = opaque;
+    if (init_avio(f, f, custom_read, seek ? custom_seek : NULL) < 0) {
+        groove_file_close(&f->externals);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate I/O context\n");
+        return NULL;
+    }
+    if (open_input(f, "", 0, NULL) < 0) {
+        groove_file_close(&f->externals);
+        return NULL;
+    }
+    return &f->externals;
+}
+
+int groove_file_open_decoder(struct GrooveFile *file) {
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
+    if (open_stub_input(f) < 0)
+        return -1;
+    return open_decoder(f);
 }
 
 // should be safe to call no matter what state the file is in
@@ -125,10 +600,17 @@ void groove_file_close(struct GrooveFile *file) {
     // disable interrupting
     f->abort_request = 0;
 
-    if (f->ic)
+    // a stand-in from the probe cache was never opened
+    if (f->ic && f->stub)
+        avformat_free_context(f->ic);
+    else if (f->ic)
         avformat_close_input(&f->ic);
 
+    // avformat does not free a caller supplied AVIOContext
+    close_avio(f);
+
     pthread_mutex_destroy(&f->seek_mutex);
+    groove_seek_index_destroy(f->seek_index);
 
     av_free(f);
 }
@@ -145,6 +627,198 @@ double groove_file_duration(struct GrooveFile *file) {
     return time_base * f->audio_st->duration;
 }
 
+// reads the audio packets through a format context of its own, so that a
+// playlist decoding the file is not disturbed. if index is not NULL, adds
+// seek points to it. returns the length in samples or < 0 on error.
+static int64_t scan_packets(struct GrooveFilePrivate *f, int sample_rate,
+        struct GrooveSeekIndex *index)
+{
+    struct GrooveMemInput mem = { 0 };
+    AVIOContext *avio = NULL;
+
+    AVFormatContext *ic = avformat_alloc_context();
+    if (!ic) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate format context\n");
+        return -1;
+    }
+    ic->interrupt_callback = f->ic->interrupt_callback;
+
+    if (f->mem.data) {
+        // share the memory, not the read position
+        mem.data = f->mem.data;
+        mem.size = f->mem.size;
+        mem.mapped = f->mem.mapped;
+        avio = alloc_avio(&mem, mem_read, mem_seek);
+        if (!avio) {
+            avformat_free_context(ic);
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate I/O context\n");
+            return -1;
+        }
+        ic->pb = avio;
+    } else if (!f->filename[0]) {
+        avformat_free_context(ic);
+        av_log(NULL, AV_LOG_ERROR, "cannot scan a file opened from callbacks\n");
+        return -1;
+    }
+
+    const char *name = f->filename[0] ? f->filename : "memory input";
+    if (avformat_open_input(&ic, f->filename, f->ic->iformat, NULL) < 0) {
+        free_avio(avio);
+        av_log(NULL, AV_LOG_ERROR, "%s: unable to open for scanning\n", name);
+        return -1;
+    }
+
+    int64_t samples = -1;
+    if (f->audio_stream_index >= ic->nb_streams) {
+        av_log(NULL, AV_LOG_ERROR, "%s: audio stream not found while scanning\n", name);
+        goto done;
+    }
+    // keep every packet in the demuxer's index, we thin it out ourselves
+    if (index)
+        ic->max_index_size = INT_MAX;
+    for (int i = 0; i < ic->nb_streams; i += 1)
+        ic->streams[i]->discard = AVDISCARD_ALL;
+    AVStream *st = ic->streams[f->audio_stream_index];
+    st->discard = AVDISCARD_DEFAULT;
+
+    // packet durations add up to the exact length. when a demuxer does not
+    // know some of them, fall back to the span of the timestamps.
+    int64_t total = 0;
+    int64_t start_pts = AV_NOPTS_VALUE;
+    int64_t end_pts = AV_NOPTS_VALUE;
+    int missing_duration = 0;
+    AVRational sample_time_base = { 1, sample_rate };
+    AVPacket pkt;
+    for (;;) {
+        int err = av_read_frame(ic, &pkt);
+        if (err == AVERROR_EOF)
+            break;
+        if (err < 0) {
+            av_log(NULL, AV_LOG_ERROR, "%s: error reading frame while scanning\n", name);
+            goto done;
+        }
+        if (pkt.stream_index == f->audio_stream_index) {
+            int64_t duration = pkt.duration;
+            if (duration <= 0) {
+                // demuxers of raw audio leave it to the codec parameters
+                int frame_samples = av_get_audio_frame_duration(st->codec, pkt.size);
+                if (frame_samples > 0)
+                    duration = av_rescale_q(frame_samples, sample_time_base, st->time_base);
+            }
+            if (duration > 0)
+                total += duration;
+            else
+                missing_duration = 1;
+            if (pkt.pts != AV_NOPTS_VALUE) {
+                if (start_pts == AV_NOPTS_VALUE || pkt.pts < start_pts)
+                    start_pts = pkt.pts;
+                if (end_pts == AV_NOPTS_VALUE || pkt.pts + duration > end_pts)
+                    end_pts = pkt.pts + duration;
+            }
+        }
+        av_free_packet(&pkt);
+    }
+    if (missing_duration) {
+        if (start_pts == AV_NOPTS_VALUE) {
+            av_log(NULL, AV_LOG_ERROR, "%s: no packet durations or timestamps\n", name);
+            goto done;
+        }
+        total = end_pts - start_pts;
+    }
+    samples = av_rescale_q(total, st->time_base, sample_time_base);
+
+    // the position of a packet is not always where it starts, as parsers
+    // report the position of the data they were given. the demuxer's own
+    // index, filled as it read, has it right.
+    if (index) {
+        int64_t interval = SEEK_INDEX_INTERVAL / av_q2d(st->time_base);
+        for (int i = 0; i < st->nb_index_entries; i += 1) {
+            AVIndexEntry *entry = &st->index_entries[i];
+            if (!(entry->flags & AVINDEX_KEYFRAME))
+                continue;
+            if (index->count > 0 && entry->timestamp - index->points[index->count - 1].ts < interval)
+                continue;
+            if (groove_seek_index_add(index, entry->pos, entry->timestamp) < 0) {
+                av_log(NULL, AV_LOG_ERROR, "unable to allocate seek index\n");
+                samples = -1;
+                goto done;
+            }
+        }
+    }
+
+    struct GrooveGapless gapless;
+    if (groove_gapless_read(ic, st, ic->pb, &gapless)) {
+        if (gapless.sample_count >= 0)
+            samples = gapless.sample_count;
+        else
+            samples = FFMAX(samples - gapless.delay - gapless.padding, 0);
+    }
+
+done:
+    avformat_close_input(&ic);
+    free_avio(avio);
+    return samples;
+}
+
+double groove_file_scan_duration(struct GrooveFile *file) {
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
+    if (f->scanned_duration >= 0)
+        return f->scanned_duration;
+
+    int sample_rate = f->audio_st->codec->sample_rate;
+    if (sample_rate <= 0) {
+        av_log(NULL, AV_LOG_ERROR, "unknown sample rate\n");
+        return -1.0;
+    }
+    int64_t samples = scan_packets(f, sample_rate, NULL);
+    if (samples < 0)
+        return -1.0;
+    f->scanned_duration = samples / (double) sample_rate;
+    return f->scanned_duration;
+}
+
+// demuxers with a generic index fill it as they read, so a seek past what
+// they have read so far reads every packet up to the target. the others,
+// such as mov and ogg, have seeking of their own and do not use one.
+static int can_seek_by_index(AVInputFormat *iformat) {
+    return (iformat->flags & AVFMT_GENERIC_INDEX) && !iformat->read_timestamp;
+}
+
+int groove_file_build_seek_index(struct GrooveFile *file) {
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
+
+    pthread_mutex_lock(&f->seek_mutex);
+    int have_index = f->seek_index != NULL;
+    pthread_mutex_unlock(&f->seek_mutex);
+    if (have_index || !can_seek_by_index(f->ic->iformat))
+        return 0;
+
+    int sample_rate = f->audio_st->codec->sample_rate;
+    if (sample_rate <= 0) {
+        av_log(NULL, AV_LOG_ERROR, "unknown sample rate\n");
+        return -1;
+    }
+    struct GrooveSeekIndex *index = groove_seek_index_create();
+    if (!index) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate seek index\n");
+        return -1;
+    }
+    if (scan_packets(f, sample_rate, index) < 0) {
+        groove_seek_index_destroy(index);
+        return -1;
+    }
+
+    // another thread may have beaten us to it
+    pthread_mutex_lock(&f->seek_mutex);
+    if (!f->seek_index) {
+        f->seek_index = index;
+        index = NULL;
+    }
+    pthread_mutex_unlock(&f->seek_mutex);
+    groove_seek_index_destroy(index);
+    return 0;
+}
+
 void groove_file_audio_format(struct GrooveFile *file, struct GrooveAudioFormat *audio_format) {
     struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
 
@@ -219,6 +893,30 @@ int groove_file_save(struct GrooveFile *file) {
 
     struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
 
+    if (!f->filename[0]) {
+        av_log(NULL, AV_LOG_ERROR, "cannot save a file that was not opened from disk\n");
+        return -1;
+    }
+
+    // the tags of some formats can be written without remuxing, and
+    // without opening a file from the probe cache. rewrites and remuxes
+    // rename a new file over the old one, which leaves a memory map of the
+    // old one alone, but extending changes the file under it.
+    int flags = GROOVE_TAGS_IN_PLACE|GROOVE_TAGS_EXTEND|GROOVE_TAGS_REWRITE;
+    if (f->mem.mapped)
+        flags |= GROOVE_TAGS_NO_SHRINK;
+    int written = groove_tags_write(f->filename, f->ic->iformat->name, f->ic->metadata,
+            file->tag_padding, flags);
+    if (written < 0)
+        return -1;
+    if (written > 0) {
+        file->dirty = 0;
+        return 0;
+    }
+
+    if (open_stub_input(f) < 0)
+        return -1;
+
     // detect output format
     AVOutputFormat *ofmt = av_guess_format(f->ic->iformat->name, f->ic->filename, NULL);
     if (!ofmt) {
@@ -376,6 +1074,11 @@ int groove_file_save(struct GrooveFile *file) {
     f->tempfile_exists = 0;
     cleanup_save(file);
 
+    // the muxer leaves no room for the tags to grow; add some where that
+    // does not mean another rewrite of the whole file
+    groove_tags_write(f->ic->filename, f->ic->iformat->name, f->ic->metadata,
+            file->tag_padding, GROOVE_TAGS_EXTEND);
+
     file->dirty = 0;
     return 0;
 }
@@ -9,12 +9,27 @@
 #define GROOVE_FILE_H_INCLUDED
 
 #include "groove.h"
+#include "seekindex.h"
 
 #include <libavformat/avformat.h>
 #include <pthread.h>
 
+// memory input, either a private mapping of the file or caller data
+struct GrooveMemInput {
+    const uint8_t *data;
+    int64_t size;
+    int64_t pos;
+    int mapped; // whether data is our own mapping
+    int64_t advised; // end of the range we last asked the kernel to read ahead
+};
+
 struct GrooveFilePrivate {
     struct GrooveFile externals;
+    char filename[1024]; // empty for memory and callback input
+    int open_flags;
+    // ic is a stand-in built from the probe cache; the file itself has not
+    // been opened yet
+    int stub;
     int audio_stream_index;
     int abort_request; // true when we're closing the file
     AVFormatContext *ic;
@@ -25,11 +40,47 @@ struct GrooveFilePrivate {
     pthread_mutex_t seek_mutex;
     int64_t seek_pos; // -1 if no seek request
     int seek_flush; // whether the seek request wants us to flush the buffer
+    // built by groove_file_build_seek_index, NULL until then
+    struct GrooveSeekIndex *seek_index;
+
+    // decoded audio before seek_target, in seconds, is dropped so that
+    // seeks land on the exact sample. -1 when there is nothing to drop.
+    double seek_target;
+    // set by a seek until an audio packet with a timestamp tells where it
+    // landed. seek_untimed counts the packets without one before that.
+    int seek_landing;
+    int seek_untimed;
+    // where the demuxer was asked to land, in the time base of the stream,
+    // and how many times that has been moved back because it landed past
+    // seek_target
+    int64_t seek_start;
+    int seek_retries;
+    // whether seek_index has been handed to the demuxer
+    int seek_index_applied;
 
     int eof;
     double audio_clock; // position of the decode head
+    // decoded audio before gapless_start is encoder delay and from
+    // gapless_end on it is padding, in seconds. -INFINITY and INFINITY when
+    // there is nothing to trim.
+    double gapless_start;
+    double gapless_end;
     AVPacket audio_pkt;
 
+    // custom input. when avio is non-NULL it is used instead of the
+    // default file protocol
+    AVIOContext *avio;
+
+    struct GrooveMemInput mem;
+
+    // callback input
+    int (*custom_read)(void *opaque, uint8_t *buf, int buf_size);
+    int64_t (*custom_seek)(void *opaque, int64_t offset, int whence);
+    void *custom_opaque;
+
+    // result of groove_file_scan_duration, < 0 until it has been called
+    double scanned_duration;
+
     // state while saving
     AVFormatContext *oc;
     int tempfile_exists;
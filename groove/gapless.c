@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "gapless.h"
+
+#include <libavutil/common.h>
+#include <libavutil/intreadwrite.h>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+// how much of the first mp3 frame to look at for the Xing tag, allowing
+// for some junk between the ID3v2 tag and the frame
+#define MP3_SCAN_SIZE 4096
+
+// the mp3 decoder's output lags its input by this many samples, on top of
+// the delay the encoder records
+#define MP3_DECODER_DELAY 529
+
+// the iTunSMPB value is longer than this, but everything we need comes
+// first
+#define ITUNSMPB_SIZE 128
+
+// iTunSMPB is a list of hex numbers: 0, delay, padding, sample count and
+// then some we do not care about
+static int parse_itunsmpb(const char *value, struct GrooveGapless *gapless) {
+    unsigned int zero, delay, padding;
+    unsigned long long sample_count;
+    if (sscanf(value, " %x %x %x %llx", &zero, &delay, &padding, &sample_count) != 4)
+        return 0;
+    gapless->delay = delay;
+    gapless->padding = padding;
+    gapless->sample_count = sample_count;
+    return 1;
+}
+
+static int is_mp3_frame_header(uint32_t header) {
+    return (header & 0xffe00000) == 0xffe00000 && // sync
+           ((header >> 19) & 3) != 1 && // version
+           ((header >> 17) & 3) == 1 && // layer III
+           ((header >> 12) & 15) != 15 && // bitrate
+           ((header >> 10) & 3) != 3; // sample rate
+}
+
+// LAME and encoders imitating it put delay and padding in an extension of
+// the Xing tag, which sits where the audio data of the first frame would
+// be. the mp3 demuxer reads the Xing tag but not the extension.
+static int read_lame_tag(AVIOContext *pb, struct GrooveGapless *gapless) {
+    uint8_t buf[MP3_SCAN_SIZE];
+    int64_t offset = 0;
+
+    // skip ID3v2 tags, of which there may be several
+    for (;;) {
+        if (avio_seek(pb, offset, SEEK_SET) < 0 || avio_read(pb, buf, 10) != 10)
+            return 0;
+        if (memcmp(buf, "ID3", 3) != 0)
+            break;
+        int64_t size = (buf[6] & 0x7f) << 21 | (buf[7] & 0x7f) << 14 |
+                       (buf[8] & 0x7f) << 7 | (buf[9] & 0x7f);
+        // a set footer flag means another 10 bytes
+        offset += 10 + size + ((buf[5] & 0x10) ? 10 : 0);
+    }
+
+    if (avio_seek(pb, offset, SEEK_SET) < 0)
+        return 0;
+    int size = avio_read(pb, buf, sizeof(buf));
+    const uint8_t *end = buf + size;
+    const uint8_t *frame = buf;
+    while (frame + 4 <= end && !is_mp3_frame_header(AV_RB32(frame)))
+        frame += 1;
+    if (frame + 4 > end)
+        return 0;
+
+    uint32_t header = AV_RB32(frame);
+    int mpeg1 = ((header >> 19) & 3) == 3;
+    int mono = ((header >> 6) & 3) == 3;
+    int side_info_size = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+    const uint8_t *xing = frame + 4 + side_info_size;
+    if (xing + 8 > end || (memcmp(xing, "Xing", 4) != 0 && memcmp(xing, "Info", 4) != 0))
+        return 0;
+
+    uint32_t flags = AV_RB32(xing + 4);
+    const uint8_t *lame = xing + 8;
+    int64_t frame_count = -1;
+    if (flags & 1) { // frame count
+        frame_count = AV_RB32(lame);
+        lame += 4;
+    }
+    if (flags & 2) // byte count
+        lame += 4;
+    if (flags & 4) // seek table
+        lame += 100;
+    if (flags & 8) // quality
+        lame += 4;
+
+    // the extension starts with the encoder name, "LAME3.99r" and the like
+    if (lame + 24 > end)
+        return 0;
+    for (int i = 0; i < 4; i += 1) {
+        if (!isalnum(lame[i]))
+            return 0;
+    }
+    int delay = lame[21] << 4 | lame[22] >> 4;
+    int padding = (lame[22] & 0x0f) << 8 | lame[23];
+    gapless->delay = delay + MP3_DECODER_DELAY;
+    gapless->padding = FFMAX(padding - MP3_DECODER_DELAY, 0);
+    // the frame count does not include the frame with the tag, which the
+    // demuxer skips
+    if (frame_count >= 0) {
+        int frame_size = mpeg1 ? 1152 : 576;
+        gapless->sample_count = FFMAX(frame_count * frame_size - delay - padding, 0);
+    }
+    return 1;
+}
+
+// looks for an atom of the given type among the atoms from *pos to end.
+// on success *pos is moved past it and its contents are at
+// [*start, *stop).
+static int find_atom(AVIOContext *pb, int64_t *pos, int64_t end, uint32_t type,
+        int64_t *start, int64_t *stop)
+{
+    while (*pos + 8 <= end) {
+        if (avio_seek(pb, *pos, SEEK_SET) < 0)
+            return 0;
+        uint64_t size = avio_rb32(pb);
+        uint32_t tag = avio_rl32(pb);
+        int header_size = 8;
+        if (size == 1) {
+            size = avio_rb64(pb);
+            header_size = 16;
+        } else if (size == 0) {
+            // extends to the end of its parent
+            size = end - *pos;
+        }
+        if (size < header_size || size > end - *pos)
+            return 0;
+        int64_t atom = *pos;
+        *pos += size;
+        if (tag == type) {
+            *start = atom + header_size;
+            *stop = atom + size;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// iTunes keeps iTunSMPB in a freeform "----" atom in
+// moov/udta/meta/ilst, which the mov demuxer skips
+static int read_mp4_itunsmpb(AVIOContext *pb, struct GrooveGapless *gapless) {
+    int64_t pos = 0;
+    int64_t start, end = avio_size(pb);
+    if (end <= 0)
+        return 0;
+
+    if (!find_atom(pb, &pos, end, MKTAG('m','o','o','v'), &start, &end))
+        return 0;
+    pos = start;
+    if (!find_atom(pb, &pos, end, MKTAG('u','d','t','a'), &start, &end))
+        return 0;
+    pos = start;
+    if (!find_atom(pb, &pos, end, MKTAG('m','e','t','a'), &start, &end))
+        return 0;
+    // meta has version and flags before its children
+    pos = start + 4;
+    if (!find_atom(pb, &pos, end, MKTAG('i','l','s','t'), &start, &end))
+        return 0;
+
+    int64_t ilst_pos = start;
+    int64_t ilst_end = end;
+    int64_t item_start, item_end;
+    while (find_atom(pb, &ilst_pos, ilst_end, MKTAG('-','-','-','-'), &item_start, &item_end)) {
+        char value[ITUNSMPB_SIZE];
+        int64_t name_start, name_end;
+        pos = item_start;
+        if (!find_atom(pb, &pos, item_end, MKTAG('n','a','m','e'), &name_start, &name_end))
+            continue;
+        // name and data have version and flags, data also has a locale
+        int len = name_end - name_start - 4;
+        if (len != 8 || avio_seek(pb, name_start + 4, SEEK_SET) < 0 ||
+            avio_read(pb, (uint8_t *) value, len) != len || memcmp(value, "iTunSMPB", 8) != 0)
+        {
+            continue;
+        }
+        int64_t data_start, data_end;
+        pos = item_start;
+        if (!find_atom(pb, &pos, item_end, MKTAG('d','a','t','a'), &data_start, &data_end))
+            return 0;
+        len = FFMIN(data_end - data_start - 8, (int64_t) sizeof(value) - 1);
+        if (len <= 0 || avio_seek(pb, data_start + 8, SEEK_SET) < 0 ||
+            avio_read(pb, (uint8_t *) value, len) != len)
+        {
+            return 0;
+        }
+        value[len] = 0;
+        return parse_itunsmpb(value, gapless);
+    }
+    return 0;
+}
+
+static int read_gapless(AVFormatContext *ic, AVStream *st, AVIOContext *pb,
+        struct GrooveGapless *gapless)
+{
+    AVCodecContext *avctx = st->codec;
+
+    // demuxers that pass unknown tags through, such as ogg and ape
+    AVDictionaryEntry *tag = av_dict_get(st->metadata, "iTunSMPB", NULL, 0);
+    if (!tag)
+        tag = av_dict_get(ic->metadata, "iTunSMPB", NULL, 0);
+    if (tag && parse_itunsmpb(tag->value, gapless))
+        return 1;
+
+    // the ogg demuxer already trims the end of the last page
+    if (avctx->codec_id == AV_CODEC_ID_OPUS && avctx->extradata_size >= 19 &&
+        memcmp(avctx->extradata, "OpusHead", 8) == 0)
+    {
+        gapless->delay = AV_RL16(avctx->extradata + 10);
+        return 1;
+    }
+
+    if (!pb || !pb->seekable)
+        return 0;
+
+    if (avctx->codec_id == AV_CODEC_ID_MP3 && !strcmp(ic->iformat->name, "mp3"))
+        return read_lame_tag(pb, gapless);
+    if (strstr(ic->iformat->name, "mp4"))
+        return read_mp4_itunsmpb(pb, gapless);
+    return 0;
+}
+
+int groove_gapless_read(AVFormatContext *ic, AVStream *st, AVIOContext *pb,
+        struct GrooveGapless *gapless)
+{
+    gapless->delay = 0;
+    gapless->padding = 0;
+    gapless->sample_count = -1;
+
+    int64_t pos = pb ? avio_tell(pb) : 0;
+    int found = read_gapless(ic, st, pb, gapless);
+    if (pb && pb->seekable)
+        avio_seek(pb, pos, SEEK_SET);
+
+    if (!found) {
+        gapless->delay = 0;
+        gapless->padding = 0;
+        gapless->sample_count = -1;
+    }
+    return found;
+}
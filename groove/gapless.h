@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_GAPLESS_H_INCLUDED
+#define GROOVE_GAPLESS_H_INCLUDED
+
+#include <libavformat/avformat.h>
+
+// encoder delay and padding of an audio stream, in samples at the stream's
+// sample rate as they come out of the decoder. delay is silence the encoder
+// put in front of the audio, padding is what it added at the end to fill
+// the last frame.
+struct GrooveGapless {
+    int64_t delay;
+    int64_t padding;
+    // number of samples without delay and padding, -1 if the file does
+    // not say
+    int64_t sample_count;
+};
+
+// looks for delay and padding in the LAME/Xing tag of mp3 files, the
+// iTunSMPB tag of mp4 and other files and the pre-skip of Opus streams.
+// reads from pb when the demuxer does not keep the information, and puts
+// pb back where it was.
+// returns 1 if found, 0 if not, in which case gapless is all zero with
+// sample_count -1.
+int groove_gapless_read(AVFormatContext *ic, AVStream *st, AVIOContext *pb,
+        struct GrooveGapless *gapless);
+
+#endif /* GROOVE_GAPLESS_H_INCLUDED */
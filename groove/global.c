@@ -57,6 +57,7 @@ int groove_init(void) {
 }
 
 void groove_finish(void) {
+    groove_probe_cache_close();
     if (should_deinit_network) {
         avformat_network_deinit();
         should_deinit_network = 0;
@@ -84,8 +84,29 @@ const char *groove_version(void);
 struct GrooveFile {
     int dirty; /* read-only */
     char *filename; /* read-only */
+
+    /* bytes of room groove_file_save leaves for the tags to grow when it
+     * has to rewrite the file, so that later saves can write the tags in
+     * place. defaults to 4096.
+     */
+    int tag_padding;
 };
 
+/* keep the results of probing files in a cache file at path, keyed by
+ * path, size and modification time. while it is open, groove_file_open
+ * skips format probing and stream analysis for files in the cache, and
+ * files opened with GROOVE_FILE_OPEN_METADATA_ONLY are not read at all
+ * until they are decoded or saved. the file is created when the cache is
+ * closed if it does not exist. opening a cache closes the previous one.
+ * returns 0 on success, < 0 on error
+ */
+int groove_probe_cache_open(const char *path);
+/* write new entries to disk and stop using the cache. groove_finish
+ * does this for you.
+ * returns 0 on success, < 0 on error
+ */
+int groove_probe_cache_close(void);
+
 /* flags to groove_file_metadata_*
  */
 #define GROOVE_TAG_MATCH_CASE      1
@@ -101,12 +122,69 @@ struct GrooveTag;
 const char *groove_tag_key(struct GrooveTag *tag);
 const char *groove_tag_value(struct GrooveTag *tag);
 
+/* flags to groove_file_open_flags
+ */
+
+/* read local regular files through a read-only memory map instead of
+ * the default file protocol. demuxer reads become copies out of the
+ * page cache and seeks do not touch the file descriptor. falls back to
+ * the default protocol when the file cannot be mapped.
+ */
+#define GROOVE_FILE_OPEN_MMAP           1
+
+/* only read what is needed for tags, format and duration. probing is
+ * limited to a small amount of data and the decoder is not opened, so
+ * the file cannot be played until groove_file_open_decoder is called.
+ * groove_playlist_insert does that for you.
+ */
+#define GROOVE_FILE_OPEN_METADATA_ONLY  2
+
+/* build a seek index the first time the file is seeked in a playlist,
+ * see groove_file_build_seek_index. that call to groove_playlist_seek
+ * takes as long as reading through the whole file, while the playlist
+ * keeps playing.
+ */
+#define GROOVE_FILE_OPEN_SEEK_INDEX     4
+
 /* you are always responsible for calling groove_file_close on the
  * returned GrooveFile.
  */
 struct GrooveFile *groove_file_open(char *filename);
+/* same as groove_file_open with flags, see GROOVE_FILE_OPEN_*
+ */
+struct GrooveFile *groove_file_open_flags(char *filename, int flags);
+
+/* open audio held in memory. data must stay valid and unchanged until
+ * groove_file_close. files opened this way cannot be saved.
+ */
+struct GrooveFile *groove_file_open_memory(const void *data, int64_t size);
+
+/* passed as whence to the seek callback of groove_file_open_custom to ask
+ * for the total size of the stream. return < 0 if it is unknown.
+ */
+#define GROOVE_SEEK_SIZE 0x10000
+
+/* open audio through caller supplied I/O callbacks.
+ * read fills buf with up to buf_size bytes and returns how many it
+ * wrote, 0 at end of stream or < 0 on error.
+ * seek takes SEEK_SET, SEEK_CUR, SEEK_END or GROOVE_SEEK_SIZE and returns
+ * the new position or < 0 on error. seek may be NULL for streams that
+ * cannot seek, in which case neither can the file.
+ * opaque is passed to both callbacks. files opened this way cannot be
+ * saved.
+ */
+struct GrooveFile *groove_file_open_custom(
+        int (*read)(void *opaque, uint8_t *buf, int buf_size),
+        int64_t (*seek)(void *opaque, int64_t offset, int whence),
+        void *opaque);
 void groove_file_close(struct GrooveFile *file);
 
+/* open the decoder of a file opened with GROOVE_FILE_OPEN_METADATA_ONLY.
+ * does nothing if it is already open.
+ * return 0 on success, < 0 on error
+ */
+int groove_file_open_decoder(struct GrooveFile *file);
+
 struct GrooveTag *groove_file_metadata_get(struct GrooveFile *file,
         const char *key, const struct GrooveTag *prev, int flags);
 /* key entry to add to metadata. will be strdup'd
@@ -124,6 +202,10 @@ int groove_file_metadata_set(struct GrooveFile *file, const char *key,
 const char *groove_file_short_names(struct GrooveFile *file);
 
 /* write changes made to metadata to disk.
+ * ID3v2 tags in mp3, Vorbis comments in flac, Ogg Vorbis and Opus and
+ * iTunes metadata in mp4 are written in place when they fit in the space
+ * of the old tags. otherwise, and for other formats, the file is
+ * rewritten.
  * return < 0 on error
  */
 int groove_file_save(struct GrooveFile *file);
@@ -131,10 +213,32 @@ int groove_file_save(struct GrooveFile *file);
 /* main audio stream duration in seconds. note that this relies on a
  * combination of format headers and heuristics. It can be inaccurate.
  * The most accurate way to learn the duration of a file is to use
- * GrooveLoudnessDetector
+ * groove_file_scan_duration or GrooveLoudnessDetector
  */
 double groove_file_duration(struct GrooveFile *file);
 
+/* exact duration of the main audio stream in seconds. reads every packet
+ * of the file without decoding and subtracts encoder delay and padding
+ * where the file records them (LAME tag, iTunSMPB, Opus pre-skip).
+ * only the first call reads the file; the result is remembered.
+ * files opened with groove_file_open_custom cannot be scanned.
+ * return < 0 on error
+ */
+double groove_file_scan_duration(struct GrooveFile *file);
+
+/* read every packet of the file without decoding and remember where
+ * they are, so that playlist seeks go straight to the right packet. this
+ * matters for formats whose own seeking is estimated from the bit rate or
+ * reads from the start of the file, such as VBR mp3 without a table of
+ * contents. does nothing for formats which do not need it, such as mp4
+ * and ogg, or if the index has been built already.
+ * it is safe to call this from another thread while the file is playing,
+ * which is how to avoid the wait of GROOVE_FILE_OPEN_SEEK_INDEX.
+ * files opened with groove_file_open_custom cannot be indexed.
+ * return < 0 on error
+ */
+int groove_file_build_seek_index(struct GrooveFile *file);
+
 /* get the audio format of the main audio stream of a file
  */
 void groove_file_audio_format(struct GrooveFile *file,
@@ -163,10 +267,19 @@ struct GroovePlaylist {
     /* in float format, defaults to 1.0
      */
     double volume;
+
+    /* see groove_playlist_set_crossfade. defaults to 0, no crossfade
+     */
+    double crossfade;
+    int crossfade_curve;
 };
 
 /* a playlist manages keeping an audio buffer full
  * to send the buffer to your speakers, use groove_player_create
+ * encoder delay and padding recorded in a file (LAME tag, iTunSMPB, Opus
+ * pre-skip) are cut from the decoded audio, so that the sinks see one
+ * continuous stream across items. buffer positions keep the timeline of
+ * the file, so the first buffer of such a file starts after 0.
  */
 struct GroovePlaylist *groove_playlist_create(void);
 /* this will not call groove_file_close on any files
@@ -178,6 +291,10 @@ void groove_playlist_destroy(struct GroovePlaylist *playlist);
 void groove_playlist_play(struct GroovePlaylist *playlist);
 void groove_playlist_pause(struct GroovePlaylist *playlist);
 
+/* seeks land on the exact sample, as far as the timestamps of the file
+ * allow: audio decoded before seconds is dropped and the position is
+ * exact from the first buffer on.
+ */
 void groove_playlist_seek(struct GroovePlaylist *playlist,
         struct GroovePlaylistItem *item, double seconds);
 
@@ -185,7 +302,8 @@ void groove_playlist_seek(struct GroovePlaylist *playlist,
  * remove it from the playlist.
  * next: the item to insert before. if NULL, you will append to the playlist.
  * gain: see GroovePlaylistItem structure. use 0 for no adjustment.
- * returns the newly created playlist item.
+ * opens the decoder of files opened with GROOVE_FILE_OPEN_METADATA_ONLY.
+ * returns the newly created playlist item, or NULL on error.
  */
 struct GroovePlaylistItem *groove_playlist_insert(
         struct GroovePlaylist *playlist, struct GrooveFile *file, double gain,
@@ -221,9 +339,51 @@ int groove_playlist_count(struct GroovePlaylist *playlist);
 void groove_playlist_set_gain(struct GroovePlaylist *playlist,
         struct GroovePlaylistItem *item, double gain);
 
-/* value is in float format. defaults to 1.0 */
+/* value is in float format. defaults to 1.0
+ * volume and gain are applied to decoded audio without rebuilding any
+ * filters, fading to the new value over a few milliseconds. values above 1.0
+ * amplify; integer sample formats clip instead of wrapping around.
+ */
 void groove_playlist_set_volume(struct GroovePlaylist *playlist, double volume);
 
+/* how a crossfade blends one item into the next */
+/* the gains add up to 1. uncorrelated audio sounds quieter halfway */
+#define GROOVE_CROSSFADE_LINEAR      0
+/* the squares of the gains add up to 1, which keeps the loudness steady */
+#define GROOVE_CROSSFADE_EQUAL_POWER 1
+
+/* overlap the last seconds of each item with the start of the next one,
+ * blending them with curve, one of the GROOVE_CROSSFADE_* values. use 0
+ * seconds to play items back to back.
+ * the playlist holds back that much of the item it is decoding, so the
+ * fade covers the real end of the item rather than where its duration
+ * says it is. an item shorter than the fade is faded over completely.
+ * the buffers of a fade belong to the item that is fading in.
+ * a seek cuts the fade short. sinks with disable_resample only crossfade
+ * between items with the same audio format.
+ */
+void groove_playlist_set_crossfade(struct GroovePlaylist *playlist,
+        double seconds, int curve);
+
+/* the playlist recycles the GrooveBuffers it decodes into once every
+ * reference to them is dropped. count is how many unused buffers it keeps
+ * around for reuse. defaults to 64
+ * only the GrooveBuffer itself is recycled, not the audio it points to.
+ * when the decoded audio needs no conversion it is the decoder's own
+ * memory, which libav recycles. audio that goes through conversion or a
+ * crossfade gets new memory for every buffer.
+ */
+void groove_playlist_set_buffer_pool_size(struct GroovePlaylist *playlist,
+        int count);
+
+/* hits is the number of buffers that were reused from the pool and misses
+ * is the number that had to be allocated. if misses keeps growing during
+ * playback, increase the pool size.
+ * you may pass NULL for hits or misses
+ */
+void groove_playlist_buffer_pool_stats(struct GroovePlaylist *playlist,
+        uint64_t *hits, uint64_t *misses);
+
 /************ GrooveBuffer ****************/
 
 #define GROOVE_BUFFER_NO  0
@@ -266,6 +426,19 @@ void groove_buffer_unref(struct GrooveBuffer *buffer);
  * GroovePlayer uses this internally to get the audio buffer for playback
  */
 
+/* what a sink does when its queue reaches max_buffer_size */
+/* stop decoding until this sink catches up, even if other sinks run dry */
+#define GROOVE_OVERFLOW_BLOCK         0
+/* throw away the oldest buffers to make room for new ones */
+#define GROOVE_OVERFLOW_DROP_OLDEST   1
+/* throw away everything queued so that only the newest buffer remains */
+#define GROOVE_OVERFLOW_LATEST_ONLY   2
+/* stop giving buffers to this sink. its queue is aborted as if it were
+ * detached, so groove_sink_buffer_get returns GROOVE_BUFFER_NO. detach and
+ * attach the sink again to resume.
+ */
+#define GROOVE_OVERFLOW_DETACH_ON_LAG 3
+
 struct GrooveSink {
     /* set this to the audio format you want the sink to output */
     struct GrooveAudioFormat audio_format;
@@ -305,6 +478,27 @@ struct GrooveSink {
      * groove_sink_attach
      */
     int bytes_per_sec;
+
+    /* hard limit on how much audio may wait in the queue, in sample frames.
+     * the playlist keeps decoding while any sink wants more audio, so
+     * without this a sink whose consumer stalls grows without bound.
+     * values below buffer_size are raised to buffer_size.
+     * groove_sink_create defaults this to 0, which means no limit
+     */
+    int max_buffer_size;
+    /* one of the GROOVE_OVERFLOW_* values. decides what happens when
+     * max_buffer_size is reached. with GROOVE_OVERFLOW_BLOCK the queue may
+     * go over the limit by the audio of one decoded packet.
+     * groove_sink_create defaults this to GROOVE_OVERFLOW_BLOCK
+     */
+    int overflow_policy;
+
+    /* once the queue is full, the playlist does not decode for this sink
+     * again until the queue drops below this many sample frames. it then
+     * refills up to buffer_size in one go.
+     * groove_sink_create defaults this to 0, which means half of buffer_size
+     */
+    int low_buffer_size;
 };
 
 struct GrooveSink *groove_sink_create(void);
@@ -325,11 +519,25 @@ int groove_sink_detach(struct GrooveSink *sink);
 int groove_sink_buffer_get(struct GrooveSink *sink,
         struct GrooveBuffer **buffer, int block);
 
+/* like groove_sink_buffer_get but takes up to max buffers at once, locking
+ * the queue and waking the decoder only once for the whole batch.
+ * returns < 0 on error, 0 on aborted (block=1) or no buffer ready (block=0),
+ * otherwise the number of entries stored in buffers.
+ * a NULL entry marks the end of the playlist, just like GROOVE_BUFFER_END.
+ */
+int groove_sink_buffer_get_many(struct GrooveSink *sink,
+        struct GrooveBuffer **buffers, int max, int block);
+
 /* returns < 0 on error, 0 on no buffer ready, 1 on buffer ready
  * if block is 1, block until buffer is ready
  */
 int groove_sink_buffer_peek(struct GrooveSink *sink, int block);
 
+/* how many buffers this sink has thrown away because of its overflow_policy
+ * since it was created
+ */
+uint64_t groove_sink_dropped_count(struct GrooveSink *sink);
+
 
 #ifdef __cplusplus
 }
@@ -10,19 +10,91 @@
 #include "buffer.h"
 
 #include <libavutil/opt.h>
+#include <libavutil/audio_fifo.h>
 #include <libavutil/channel_layout.h>
+#include <libavutil/mathematics.h>
 #include <libavformat/avformat.h>
 #include <libavfilter/avfilter.h>
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 
 #include <pthread.h>
+#include <stdatomic.h>
+
+// how many buffers fit in a sink's audio queue before it has to fall back
+// to allocating list nodes
+#define SINK_RING_CAPACITY 256
+
+// how many unused GrooveBuffers the playlist keeps for reuse by default
+#define DEFAULT_BUFFER_POOL_SIZE 64
+
+// how many configured filter graphs the playlist keeps so that going back
+// and forth between input formats does not rebuild them every time
+#define FILTER_GRAPH_CACHE_SIZE 4
+
+// how long it takes a volume or gain change to fully apply. ramping avoids
+// zipper noise while someone drags a volume slider
+#define GAIN_RAMP_MS 10
+
+// crossfades mix this many sample frames at a time, so that the gains of
+// the curve fit on the stack
+#define FADE_BLOCK_SIZE 256
+// audio held back for a crossfade goes out in buffers of up to this many
+// sample frames, unless the sink asks for buffer_sample_count
+#define FADE_BUFFER_SIZE 4096
+
+// how many frames of the next playlist item prime_thread decodes ahead
+#define PRIME_FRAME_COUNT 8
+// prime_thread gives up after reading this many packets
+#define PRIME_MAX_PACKETS 64
+
+// sample frames of silence pushed through a resampling graph before it is
+// cached. the filters libavresample builds are at most 16 * the resampling
+// ratio taps long, so this flushes the history of ratios up to 256:1
+#define PARK_SILENCE_SAMPLES 4096
+
+// seconds before the target where seeks start decoding, so that decoders
+// which carry state from packet to packet, such as the overlap of the
+// synthesis filter and the bit reservoir of mp3, have caught up by the
+// time the target is reached
+#define SEEK_PREROLL 0.2
+// some demuxers, such as ogg, land after the point they were asked for.
+// seeks which end up past the target are retried further back this many
+// times before falling back to the start of the file.
+#define SEEK_MAX_RETRIES 3
+// demuxers may leave the timestamps out of the first packets after a seek,
+// ogg does until the end of the first page. seeks give up on being exact if
+// none turns up in this many packets.
+#define SEEK_MAX_UNTIMED 256
+
+enum PrimeState {
+    PRIME_IDLE,
+    PRIME_REQUESTED,
+    PRIME_BUSY,
+    PRIME_READY,
+};
+
+// a frame decoded ahead of time by prime_thread
+struct PrimedFrame {
+    AVFrame *frame;
+    double clock; // audio_clock at the start of this frame
+    struct PrimedFrame *next;
+};
 
 struct GrooveSinkPrivate {
     struct GrooveSink externals;
     struct GrooveQueue *audioq;
-    int audioq_size; // in bytes
-    int min_audioq_size; // in bytes
+    // in bytes. updated by decode_thread without the queue lock
+    atomic_int audioq_size;
+    int min_audioq_size; // in bytes. decode_thread fills the queue up to here
+    // in bytes. decode_thread is only woken up once the queue drops below this
+    int low_audioq_size;
+    int max_audioq_size; // in bytes. 0 for no limit
+    // set by decode_thread when GROOVE_OVERFLOW_DETACH_ON_LAG kicks in.
+    // protected by decode_head_mutex
+    int cut_off;
+    // buffers thrown away because of the overflow policy
+    atomic_uint_least64_t dropped_count;
 };
 
 struct SinkStack {
@@ -34,9 +106,50 @@ struct SinkMap {
     struct SinkStack *stack_head;
     AVFilterContext *aformat_ctx;
     AVFilterContext *abuffersink_ctx;
+    // gain applied to the end of the last buffer, where a ramp towards
+    // gain_target is headed, and how far along it is
+    double gain;
+    double gain_target;
+    double gain_step;
+    int gain_ramp_left; // in sample frames
+
+    // output held back for a crossfade, in the format of fade_frame.
+    // fade_hold is the end of the item being decoded, which is fade_hold_item
+    // from fade_hold_pos on. fade_tail is the end of the item before it,
+    // from fade_tail_pos in fade_tail_item, which the item being decoded
+    // fades in over. the fade is fade_tail_len sample frames long and
+    // fade_tail_done into it.
+    AVAudioFifo *fade_hold;
+    struct GroovePlaylistItem *fade_hold_item;
+    double fade_hold_pos;
+    AVAudioFifo *fade_tail;
+    struct GroovePlaylistItem *fade_tail_item;
+    double fade_tail_pos;
+    int fade_tail_len;
+    int fade_tail_done;
+    // what is read from fade_tail goes here to be mixed
+    AVFrame *fade_frame;
+
     struct SinkMap *next;
 };
 
+// a configured filter graph and the input it was built for
+struct FilterGraphCacheItem {
+    AVFilterGraph *filter_graph;
+    AVFilterContext *abuffer_ctx;
+    AVFilterContext *asplit_ctx;
+    // aformat and abuffersink of each sink map entry, in sink map order
+    AVFilterContext **aformat_ctxs;
+    AVFilterContext **abuffersink_ctxs;
+
+    int in_sample_rate;
+    uint64_t in_channel_layout;
+    enum AVSampleFormat in_sample_fmt;
+    AVRational in_time_base;
+
+    struct FilterGraphCacheItem *next;
+};
+
 struct GroovePlaylistPrivate {
     struct GroovePlaylist externals;
     pthread_t thread_id;
@@ -44,6 +157,9 @@ struct GroovePlaylistPrivate {
 
     AVPacket audio_pkt_temp;
     AVFrame *in_frame;
+    // buffersink output lands here first, so that pulling nothing does not
+    // take a buffer from the pool
+    AVFrame *sink_frame;
     int paused;
     int last_paused;
 
@@ -53,9 +169,14 @@ struct GroovePlaylistPrivate {
     AVRational in_time_base;
 
     char strbuf[512];
+    // decoded GrooveBuffers and their AVFrames are recycled through here
+    struct GrooveBufferPool *buffer_pool;
+    // most recently used first. the first item is the graph in use, and
+    // the fields below point into it
+    struct FilterGraphCacheItem *graph_cache;
+    int graph_cache_count;
     AVFilterGraph *filter_graph;
     AVFilterContext *abuffer_ctx;
-    AVFilterContext *volume_ctx;
     AVFilterContext *asplit_ctx;
 
     // this mutex applies to the variables in this block
@@ -70,9 +191,9 @@ struct GroovePlaylistPrivate {
     char sink_drain_cond_inited;
     // pointer to current playlist item being decoded
     struct GroovePlaylistItem *decode_head;
-    // desired volume for the volume filter
+    // desired gain, applied to the output of the filter graph
     double volume;
-    // set to 1 to trigger a rebuild
+    // set to 1 to throw away every cached graph, because the sink map changed
     int rebuild_filter_graph_flag;
     // map audio format to list of sinks
     // for each map entry, use the first sink in the stack as the example
@@ -80,13 +201,35 @@ struct GroovePlaylistPrivate {
     struct SinkMap *sink_map;
     int sink_map_count;
 
-    // the value for volume that was used to construct the filter graph
-    double filter_volume;
-
     // only touched by decode_thread, tells whether we have sent the end_of_q_sentinel
     int sent_end_of_q;
 
     struct GroovePlaylistItem *purge_item; // set temporarily
+
+    // only touched by decode_thread with decode_head_mutex held.
+    // decode_head and its next item when we last asked for priming
+    struct GroovePlaylistItem *prime_after;
+    struct GroovePlaylistItem *prime_next;
+    // frames primed for pending_item that have not been filtered yet
+    struct GroovePlaylistItem *pending_item;
+    struct PrimedFrame *pending_head;
+
+    // prime_thread seeks and decodes the start of the item after decode_head
+    // so that moving on to it does not have to wait for the file.
+    pthread_t prime_thread_id;
+    char prime_thread_inited;
+    AVFrame *prime_frame;
+    // tells prime_thread to stop decoding early
+    atomic_int prime_abort;
+    // this mutex applies to the variables in this block
+    pthread_mutex_t prime_mutex;
+    char prime_mutex_inited;
+    // signaled whenever prime_state changes
+    pthread_cond_t prime_cond;
+    char prime_cond_inited;
+    enum PrimeState prime_state;
+    struct GroovePlaylistItem *prime_item;
+    struct PrimedFrame *primed_head; // set when prime_state is PRIME_READY
 };
 
 // this is used to tell the difference between a buffer underrun
@@ -99,44 +242,797 @@ static int frame_size(const AVFrame *frame) {
         frame->nb_samples;
 }
 
-static struct GrooveBuffer * frame_to_groove_buffer(struct GroovePlaylist *playlist,
-        struct GrooveSink *sink, AVFrame *frame)
+// fill in the GrooveBuffer fields from the frame that was pulled into b,
+// which is audio of item from pos on
+static struct GrooveBuffer * frame_to_groove_buffer(struct GrooveBufferPrivate *b,
+        struct GroovePlaylistItem *item, double pos)
 {
-    struct GrooveBufferPrivate *b = av_mallocz(sizeof(struct GrooveBufferPrivate));
+    struct GrooveBuffer *buffer = &b->externals;
+    AVFrame *frame = b->frame;
 
-    if (!b) {
-        av_log(NULL, AV_LOG_ERROR, "unable to allocate buffer\n");
-        return NULL;
+    buffer->item = item;
+    buffer->pos = pos;
+
+    buffer->data = frame->extended_data;
+    buffer->frame_count = frame->nb_samples;
+    buffer->format.channel_layout = frame->channel_layout;
+    buffer->format.sample_fmt = frame->format;
+    buffer->format.sample_rate = frame->sample_rate;
+    buffer->size = frame_size(frame);
+
+    return buffer;
+}
+
+
+// the gain loops below are written so that the compiler can vectorize the
+// part after the ramp, which is nearly all of them.
+// each one scales frame_count sample frames of stride samples each. the
+// first ramp frames get start, start + step, ... and the rest get end.
+
+static void gain_flt(float *restrict s, int frame_count, int stride,
+        float start, float step, int ramp, float end)
+{
+    for (int i = 0; i < ramp; i += 1) {
+        float g = start + step * i;
+        for (int c = 0; c < stride; c += 1)
+            s[i * stride + c] *= g;
     }
+    s += ramp * stride;
+    int n = (frame_count - ramp) * stride;
+    for (int i = 0; i < n; i += 1)
+        s[i] *= end;
+}
 
-    struct GrooveBuffer *buffer = &b->externals;
+static void gain_dbl(double *restrict s, int frame_count, int stride,
+        double start, double step, int ramp, double end)
+{
+    for (int i = 0; i < ramp; i += 1) {
+        double g = start + step * i;
+        for (int c = 0; c < stride; c += 1)
+            s[i * stride + c] *= g;
+    }
+    s += ramp * stride;
+    int n = (frame_count - ramp) * stride;
+    for (int i = 0; i < n; i += 1)
+        s[i] *= end;
+}
 
-    if (pthread_mutex_init(&b->mutex, NULL) != 0) {
-        av_free(b);
-        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
-        return NULL;
+static void gain_s16(int16_t *restrict s, int frame_count, int stride,
+        float start, float step, int ramp, float end)
+{
+    for (int i = 0; i < ramp; i += 1) {
+        float g = start + step * i;
+        for (int c = 0; c < stride; c += 1) {
+            float v = s[i * stride + c] * g;
+            s[i * stride + c] = v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+        }
+    }
+    s += ramp * stride;
+    int n = (frame_count - ramp) * stride;
+    for (int i = 0; i < n; i += 1) {
+        float v = s[i] * end;
+        s[i] = v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+    }
+}
+
+static void gain_s32(int32_t *restrict s, int frame_count, int stride,
+        double start, double step, int ramp, double end)
+{
+    int n = frame_count * stride;
+    for (int i = 0; i < n; i += 1) {
+        int frame_index = i / stride;
+        double g = frame_index < ramp ? start + step * frame_index : end;
+        double v = s[i] * g;
+        s[i] = v > INT32_MAX ? INT32_MAX : (v < INT32_MIN ? INT32_MIN : v);
+    }
+}
+
+static void gain_u8(uint8_t *restrict s, int frame_count, int stride,
+        float start, float step, int ramp, float end)
+{
+    int n = frame_count * stride;
+    for (int i = 0; i < n; i += 1) {
+        int frame_index = i / stride;
+        float g = frame_index < ramp ? start + step * frame_index : end;
+        float v = (s[i] - 128) * g + 128;
+        s[i] = v > UINT8_MAX ? UINT8_MAX : (v < 0 ? 0 : v);
+    }
+}
+
+// scale the samples of a buffer that came out of map_item's buffersink by
+// the playlist volume, ramping from the previous volume
+static int apply_gain(struct GroovePlaylistPrivate *p, struct SinkMap *map_item,
+        AVFrame *frame)
+{
+    double target = p->volume > 0.0 ? p->volume : 0.0;
+    if (target != map_item->gain_target) {
+        map_item->gain_target = target;
+        map_item->gain_ramp_left = frame->sample_rate * GAIN_RAMP_MS / 1000;
+        if (map_item->gain_ramp_left < 1)
+            map_item->gain_ramp_left = 1;
+        map_item->gain_step = (map_item->gain_target - map_item->gain) /
+            map_item->gain_ramp_left;
+    }
+
+    if (map_item->gain_ramp_left == 0 && map_item->gain == 1.0)
+        return 0;
+
+    // asplit and aformat may hand the same data to other sinks
+    int err = av_frame_make_writable(frame);
+    if (err < 0)
+        return err;
+
+    int ramp = map_item->gain_ramp_left < frame->nb_samples ?
+        map_item->gain_ramp_left : frame->nb_samples;
+    double start = map_item->gain + map_item->gain_step;
+    double step = map_item->gain_step;
+    map_item->gain_ramp_left -= ramp;
+    map_item->gain = map_item->gain_ramp_left == 0 ?
+        map_item->gain_target : map_item->gain + step * ramp;
+    double end = map_item->gain;
+
+    int planar = av_sample_fmt_is_planar(frame->format);
+    int channel_count = av_get_channel_layout_nb_channels(frame->channel_layout);
+    int plane_count = planar ? channel_count : 1;
+    int stride = planar ? 1 : channel_count;
+    for (int i = 0; i < plane_count; i += 1) {
+        uint8_t *data = frame->extended_data[i];
+        switch (av_get_packed_sample_fmt(frame->format)) {
+        case AV_SAMPLE_FMT_FLT:
+            gain_flt((float *)data, frame->nb_samples, stride, start, step, ramp, end);
+            break;
+        case AV_SAMPLE_FMT_DBL:
+            gain_dbl((double *)data, frame->nb_samples, stride, start, step, ramp, end);
+            break;
+        case AV_SAMPLE_FMT_S16:
+            gain_s16((int16_t *)data, frame->nb_samples, stride, start, step, ramp, end);
+            break;
+        case AV_SAMPLE_FMT_S32:
+            gain_s32((int32_t *)data, frame->nb_samples, stride, start, step, ramp, end);
+            break;
+        case AV_SAMPLE_FMT_U8:
+            gain_u8(data, frame->nb_samples, stride, start, step, ramp, end);
+            break;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+// the mix loops below are written so that the compiler can vectorize them
+// like the gain loops. each one sets dst to dst * gain_dst + src * gain_src
+// over frame_count sample frames of stride samples each, with a gain for
+// every sample frame.
+
+static void mix_flt(float *dst, const float *src, int frame_count, int stride,
+        const float *gain_dst, const float *gain_src)
+{
+    for (int i = 0; i < frame_count; i += 1) {
+        for (int c = 0; c < stride; c += 1) {
+            int j = i * stride + c;
+            dst[j] = dst[j] * gain_dst[i] + src[j] * gain_src[i];
+        }
+    }
+}
+
+static void mix_dbl(double *dst, const double *src, int frame_count, int stride,
+        const float *gain_dst, const float *gain_src)
+{
+    for (int i = 0; i < frame_count; i += 1) {
+        for (int c = 0; c < stride; c += 1) {
+            int j = i * stride + c;
+            dst[j] = dst[j] * gain_dst[i] + src[j] * gain_src[i];
+        }
+    }
+}
+
+static void mix_s16(int16_t *dst, const int16_t *src, int frame_count, int stride,
+        const float *gain_dst, const float *gain_src)
+{
+    for (int i = 0; i < frame_count; i += 1) {
+        for (int c = 0; c < stride; c += 1) {
+            int j = i * stride + c;
+            float v = dst[j] * gain_dst[i] + src[j] * gain_src[i];
+            dst[j] = v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+        }
+    }
+}
+
+static void mix_s32(int32_t *dst, const int32_t *src, int frame_count, int stride,
+        const float *gain_dst, const float *gain_src)
+{
+    for (int i = 0; i < frame_count; i += 1) {
+        for (int c = 0; c < stride; c += 1) {
+            int j = i * stride + c;
+            double v = dst[j] * (double)gain_dst[i] + src[j] * (double)gain_src[i];
+            dst[j] = v > INT32_MAX ? INT32_MAX : (v < INT32_MIN ? INT32_MIN : v);
+        }
+    }
+}
+
+static void mix_u8(uint8_t *dst, const uint8_t *src, int frame_count, int stride,
+        const float *gain_dst, const float *gain_src)
+{
+    for (int i = 0; i < frame_count; i += 1) {
+        for (int c = 0; c < stride; c += 1) {
+            int j = i * stride + c;
+            float v = (dst[j] - 128) * gain_dst[i] + (src[j] - 128) * gain_src[i] + 128;
+            dst[j] = v > UINT8_MAX ? UINT8_MAX : (v < 0 ? 0 : v);
+        }
+    }
+}
+
+// mix count sample frames of src into dst, starting offset sample frames
+// into dst. both are in the same format.
+static void mix_frame(AVFrame *dst, int offset, const AVFrame *src, int count,
+        const float *gain_dst, const float *gain_src)
+{
+    int planar = av_sample_fmt_is_planar(dst->format);
+    int channel_count = av_get_channel_layout_nb_channels(dst->channel_layout);
+    int plane_count = planar ? channel_count : 1;
+    int stride = planar ? 1 : channel_count;
+    int skip = offset * stride * av_get_bytes_per_sample(dst->format);
+    for (int i = 0; i < plane_count; i += 1) {
+        uint8_t *d = dst->extended_data[i] + skip;
+        const uint8_t *s = src->extended_data[i];
+        switch (av_get_packed_sample_fmt(dst->format)) {
+        case AV_SAMPLE_FMT_FLT:
+            mix_flt((float *)d, (const float *)s, count, stride, gain_dst, gain_src);
+            break;
+        case AV_SAMPLE_FMT_DBL:
+            mix_dbl((double *)d, (const double *)s, count, stride, gain_dst, gain_src);
+            break;
+        case AV_SAMPLE_FMT_S16:
+            mix_s16((int16_t *)d, (const int16_t *)s, count, stride, gain_dst, gain_src);
+            break;
+        case AV_SAMPLE_FMT_S32:
+            mix_s32((int32_t *)d, (const int32_t *)s, count, stride, gain_dst, gain_src);
+            break;
+        case AV_SAMPLE_FMT_U8:
+            mix_u8(d, s, count, stride, gain_dst, gain_src);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// the gains of count sample frames, done sample frames into a crossfade of
+// len, for the item fading in and the one fading out
+static void fade_gains(int curve, int done, int len, int count,
+        float *gain_in, float *gain_out)
+{
+    for (int i = 0; i < count; i += 1) {
+        double t = (done + i) / (double)len;
+        if (curve == GROOVE_CROSSFADE_EQUAL_POWER) {
+            gain_in[i] = sin(t * M_PI_2);
+            gain_out[i] = cos(t * M_PI_2);
+        } else {
+            gain_in[i] = t;
+            gain_out[i] = 1.0 - t;
+        }
+    }
+}
+
+// put end_of_q_sentinel back in front of the buffers left in the queue of
+// s. the queue only takes from the front, so they all come out and go back
+// in behind it. only decode_thread puts, so nothing gets in between.
+static void sink_requeue_end(struct GrooveSinkPrivate *s) {
+    struct GrooveBuffer **rest = NULL;
+    int rest_count = 0;
+    int rest_alloc = 0;
+    struct GrooveBuffer *buffer;
+    while (groove_queue_get(s->audioq, (void**)&buffer, 0) == 1) {
+        if (rest_count == rest_alloc) {
+            int new_alloc = rest_alloc ? 2 * rest_alloc : 16;
+            struct GrooveBuffer **new_rest = av_realloc(rest, new_alloc * sizeof(struct GrooveBuffer *));
+            if (!new_rest) {
+                // the sink is over its limit anyway, so what does not fit
+                // is dropped like the buffers before it
+                av_log(NULL, AV_LOG_ERROR, "unable to requeue buffers: out of memory\n");
+                atomic_fetch_add(&s->dropped_count, 1);
+                groove_buffer_unref(buffer);
+                continue;
+            }
+            rest = new_rest;
+            rest_alloc = new_alloc;
+        }
+        rest[rest_count++] = buffer;
+    }
+
+    groove_queue_put(s->audioq, end_of_q_sentinel);
+    for (int i = 0; i < rest_count; i += 1)
+        groove_queue_put(s->audioq, rest[i]);
+    av_free(rest);
+}
+
+// throw away the oldest buffers of s until at most limit bytes are queued,
+// counting them as dropped. the end of the playlist is not audio, so it is never thrown away
+static void sink_drop(struct GrooveSinkPrivate *s, int limit) {
+    int dropped_end = 0;
+    struct GrooveBuffer *buffer;
+    while (atomic_load(&s->audioq_size) > limit &&
+            groove_queue_get(s->audioq, (void**)&buffer, 0) == 1)
+    {
+        if (buffer == end_of_q_sentinel) {
+            dropped_end = 1;
+            continue;
+        }
+        atomic_fetch_add(&s->dropped_count, 1);
+        groove_buffer_unref(buffer);
+    }
+    if (dropped_end && !s->cut_off)
+        sink_requeue_end(s);
+}
+
+// enforce the hard cap of s before putting a buffer of size bytes in it.
+// returns 0 if the buffer must not go to this sink
+static int sink_make_room(struct GrooveSinkPrivate *s, int size) {
+    struct GrooveSink *sink = &s->externals;
+
+    if (s->cut_off)
+        return 0;
+    if (s->max_audioq_size <= 0 ||
+        atomic_load(&s->audioq_size) + size <= s->max_audioq_size)
+    {
+        return 1;
+    }
+
+    switch (sink->overflow_policy) {
+    case GROOVE_OVERFLOW_DROP_OLDEST:
+        sink_drop(s, s->max_audioq_size - size);
+        return 1;
+    case GROOVE_OVERFLOW_LATEST_ONLY:
+        sink_drop(s, 0);
+        return 1;
+    case GROOVE_OVERFLOW_DETACH_ON_LAG:
+        av_log(NULL, AV_LOG_WARNING, "sink fell behind, cutting it off\n");
+        s->cut_off = 1;
+        sink_drop(s, -1);
+        groove_queue_abort(s->audioq);
+        return 0;
+    default:
+        // GROOVE_OVERFLOW_BLOCK. decode_thread stops before the next packet
+        return 1;
+    }
+}
+
+// hand buffer to every sink in map_item's stack. takes over the reference
+// to buffer
+static void send_buffer(struct SinkMap *map_item, struct GrooveBuffer *buffer) {
+    int size = buffer->size;
+    struct SinkStack *stack_item = map_item->stack_head;
+    // the reference we got from the pool avoids cleanups until at least
+    // this loop is done and we call unref after it.
+    while (stack_item) {
+        struct GrooveSink *sink = stack_item->sink;
+        struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
+        // as soon as we call groove_queue_put, this buffer could be unref'd.
+        // so we ref before putting it in the queue, and unref if it failed.
+        if (!sink_make_room(s, size)) {
+            stack_item = stack_item->next;
+            continue;
+        }
+        groove_buffer_ref(buffer);
+        if (groove_queue_put(s->audioq, buffer) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "unable to put buffer in queue\n");
+            groove_buffer_unref(buffer);
+        }
+        stack_item = stack_item->next;
+    }
+    groove_buffer_unref(buffer);
+}
+
+static void fade_free(struct SinkMap *map_item) {
+    if (map_item->fade_hold)
+        av_audio_fifo_free(map_item->fade_hold);
+    if (map_item->fade_tail)
+        av_audio_fifo_free(map_item->fade_tail);
+    av_frame_free(&map_item->fade_frame);
+    map_item->fade_hold = NULL;
+    map_item->fade_tail = NULL;
+    map_item->fade_hold_item = NULL;
+    map_item->fade_tail_item = NULL;
+}
+
+// forget the audio held back for a crossfade, as a seek does
+static void fade_reset(struct SinkMap *map_item) {
+    if (!map_item->fade_frame)
+        return;
+    av_audio_fifo_reset(map_item->fade_hold);
+    av_audio_fifo_reset(map_item->fade_tail);
+    map_item->fade_hold_item = NULL;
+    map_item->fade_tail_item = NULL;
+}
+
+static void every_fade_reset(struct GroovePlaylistPrivate *p) {
+    struct SinkMap *map_item = p->sink_map;
+    while (map_item) {
+        fade_reset(map_item);
+        map_item = map_item->next;
+    }
+}
+
+// hand what fade_hold has beyond its last keep sample frames to the sinks
+// of map_item
+static int fade_emit(struct GroovePlaylistPrivate *p, struct SinkMap *map_item, int keep) {
+    struct GrooveSink *example_sink = map_item->stack_head->sink;
+    const AVFrame *fade_frame = map_item->fade_frame;
+    for (;;) {
+        int count = av_audio_fifo_size(map_item->fade_hold) - keep;
+        if (count <= 0)
+            return 0;
+        if (example_sink->buffer_sample_count > 0) {
+            // whole buffers only, except for the very end
+            if (count < example_sink->buffer_sample_count && keep > 0)
+                return 0;
+            count = FFMIN(count, example_sink->buffer_sample_count);
+        } else {
+            count = FFMIN(count, FADE_BUFFER_SIZE);
+        }
+
+        struct GrooveBufferPrivate *b = groove_buffer_pool_get(p->buffer_pool);
+        if (!b) {
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate buffer\n");
+            return -1;
+        }
+        AVFrame *frame = b->frame;
+        frame->format = fade_frame->format;
+        frame->channel_layout = fade_frame->channel_layout;
+        frame->sample_rate = fade_frame->sample_rate;
+        frame->nb_samples = count;
+        // the pool only recycles the buffer, the samples are new
+        if (av_frame_get_buffer(frame, 0) < 0) {
+            groove_buffer_unref(&b->externals);
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate buffer\n");
+            return -1;
+        }
+        av_audio_fifo_read(map_item->fade_hold, (void **)frame->extended_data, count);
+        struct GrooveBuffer *buffer = frame_to_groove_buffer(b,
+                map_item->fade_hold_item, map_item->fade_hold_pos);
+        map_item->fade_hold_pos += count / (double)frame->sample_rate;
+        send_buffer(map_item, buffer);
+    }
+}
+
+// fade out the rest of fade_tail onto the end of fade_hold, because the
+// item fading in ended before the fade did
+static int fade_finish_tail(struct GroovePlaylist *playlist, struct SinkMap *map_item) {
+    AVAudioFifo *tail = map_item->fade_tail;
+    if (av_audio_fifo_size(tail) == 0)
+        return 0;
+    // nothing of the item fading in came through
+    if (!map_item->fade_hold_item) {
+        map_item->fade_hold_item = map_item->fade_tail_item;
+        map_item->fade_hold_pos = map_item->fade_tail_pos +
+            map_item->fade_tail_done / (double)map_item->fade_frame->sample_rate;
     }
 
+    AVFrame *fade_frame = map_item->fade_frame;
+    float gain_in[FADE_BLOCK_SIZE];
+    float gain_out[FADE_BLOCK_SIZE];
+    float silent[FADE_BLOCK_SIZE] = {0};
+    int count;
+    while ((count = FFMIN(av_audio_fifo_size(tail), FADE_BLOCK_SIZE)) > 0) {
+        av_audio_fifo_read(tail, (void **)fade_frame->extended_data, count);
+        fade_gains(playlist->crossfade_curve, map_item->fade_tail_done,
+                map_item->fade_tail_len, count, gain_in, gain_out);
+        mix_frame(fade_frame, 0, fade_frame, count, gain_out, silent);
+        map_item->fade_tail_done += count;
+        if (av_audio_fifo_write(map_item->fade_hold, (void **)fade_frame->extended_data, count) < count) {
+            av_log(NULL, AV_LOG_ERROR, "unable to hold back audio: out of memory\n");
+            av_audio_fifo_reset(tail);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// the item being decoded has ended. what was held back of it becomes the
+// tail that the next item fades in over.
+static void fade_start(struct GroovePlaylist *playlist, struct SinkMap *map_item) {
+    fade_finish_tail(playlist, map_item);
+    AVAudioFifo *hold = map_item->fade_hold;
+    map_item->fade_hold = map_item->fade_tail;
+    map_item->fade_tail = hold;
+    map_item->fade_tail_item = map_item->fade_hold_item;
+    map_item->fade_tail_pos = map_item->fade_hold_pos;
+    map_item->fade_tail_len = av_audio_fifo_size(hold);
+    map_item->fade_tail_done = 0;
+    map_item->fade_hold_item = NULL;
+}
+
+// let out everything held back
+static int fade_end(struct GroovePlaylist *playlist, struct SinkMap *map_item) {
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
-    struct GrooveFile *file = p->decode_head->file;
+    fade_finish_tail(playlist, map_item);
+    return fade_emit(p, map_item, 0);
+}
 
-    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
+// the item being decoded has ended. fade it into the next one, or let it
+// out if there is none
+static void every_fade_next(struct GroovePlaylist *playlist, int has_next) {
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+    struct SinkMap *map_item = p->sink_map;
+    while (map_item) {
+        if (map_item->fade_frame) {
+            if (has_next && playlist->crossfade > 0.0)
+                fade_start(playlist, map_item);
+            else
+                fade_end(playlist, map_item);
+        }
+        map_item = map_item->next;
+    }
+}
 
-    buffer->item = p->decode_head;
-    buffer->pos = f->audio_clock;
+static int same_audio_format(const AVFrame *a, const AVFrame *b) {
+    return a->format == b->format &&
+        a->channel_layout == b->channel_layout &&
+        a->sample_rate == b->sample_rate;
+}
 
-    buffer->data = frame->extended_data;
-    buffer->frame_count = frame->nb_samples;
-    buffer->format.channel_layout = frame->channel_layout;
-    buffer->format.sample_fmt = frame->format;
-    buffer->format.sample_rate = frame->sample_rate;
-    buffer->size = frame_size(frame);
+// get map_item ready to hold back audio in the format of frame. audio
+// held back in another format is let out, without a fade.
+static int fade_init(struct GroovePlaylist *playlist, struct SinkMap *map_item,
+        const AVFrame *frame)
+{
+    if (map_item->fade_frame) {
+        if (same_audio_format(map_item->fade_frame, frame))
+            return 0;
+        fade_end(playlist, map_item);
+        fade_free(map_item);
+    }
+
+    int channel_count = av_get_channel_layout_nb_channels(frame->channel_layout);
+    map_item->fade_hold = av_audio_fifo_alloc(frame->format, channel_count, FADE_BLOCK_SIZE);
+    map_item->fade_tail = av_audio_fifo_alloc(frame->format, channel_count, FADE_BLOCK_SIZE);
+    map_item->fade_frame = av_frame_alloc();
+    if (!map_item->fade_hold || !map_item->fade_tail || !map_item->fade_frame) {
+        fade_free(map_item);
+        av_log(NULL, AV_LOG_ERROR, "unable to set up crossfade: out of memory\n");
+        return -1;
+    }
+    AVFrame *fade_frame = map_item->fade_frame;
+    fade_frame->format = frame->format;
+    fade_frame->channel_layout = frame->channel_layout;
+    fade_frame->sample_rate = frame->sample_rate;
+    fade_frame->nb_samples = FADE_BLOCK_SIZE;
+    if (av_frame_get_buffer(fade_frame, 0) < 0) {
+        fade_free(map_item);
+        av_log(NULL, AV_LOG_ERROR, "unable to set up crossfade: out of memory\n");
+        return -1;
+    }
+    return 0;
+}
 
-    b->frame = frame;
+// mix the start of b's frame with the tail of the previous item, if it is
+// still fading out, and hold back the last crossfade seconds of it. what
+// comes before goes out to the sinks. takes over the reference to b.
+// returns the size of b's frame
+static int fade_put(struct GroovePlaylist *playlist, struct SinkMap *map_item,
+        struct GrooveBufferPrivate *b)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) p->decode_head->file;
+    AVFrame *frame = b->frame;
+    int size = frame_size(frame);
 
-    return buffer;
+    if (fade_init(playlist, map_item, frame) < 0) {
+        groove_buffer_unref(&b->externals);
+        return -1;
+    }
+    if (av_audio_fifo_size(map_item->fade_hold) == 0) {
+        map_item->fade_hold_item = p->decode_head;
+        map_item->fade_hold_pos = f->audio_clock;
+    }
+
+    AVAudioFifo *tail = map_item->fade_tail;
+    if (av_audio_fifo_size(tail) > 0) {
+        // asplit and aformat may hand the same data to other sinks
+        if (av_frame_make_writable(frame) < 0) {
+            groove_buffer_unref(&b->externals);
+            av_log(NULL, AV_LOG_ERROR, "unable to crossfade: out of memory\n");
+            return -1;
+        }
+        AVFrame *fade_frame = map_item->fade_frame;
+        float gain_in[FADE_BLOCK_SIZE];
+        float gain_out[FADE_BLOCK_SIZE];
+        int done = 0;
+        int count;
+        while ((count = FFMIN3(frame->nb_samples - done, av_audio_fifo_size(tail),
+                        FADE_BLOCK_SIZE)) > 0)
+        {
+            av_audio_fifo_read(tail, (void **)fade_frame->extended_data, count);
+            fade_gains(playlist->crossfade_curve, map_item->fade_tail_done,
+                    map_item->fade_tail_len, count, gain_in, gain_out);
+            mix_frame(frame, done, fade_frame, count, gain_in, gain_out);
+            map_item->fade_tail_done += count;
+            done += count;
+        }
+    }
+
+    int keep = llrint(playlist->crossfade * frame->sample_rate);
+    int written = av_audio_fifo_write(map_item->fade_hold, (void **)frame->extended_data,
+            frame->nb_samples);
+    int complete = written == frame->nb_samples;
+    groove_buffer_unref(&b->externals);
+    if (!complete) {
+        av_log(NULL, AV_LOG_ERROR, "unable to hold back audio: out of memory\n");
+        return -1;
+    }
+
+    if (fade_emit(p, map_item, keep) < 0)
+        return -1;
+
+    // crossfade was turned off and everything held back is out
+    if (keep == 0 && av_audio_fifo_size(tail) == 0)
+        fade_free(map_item);
+    return size;
+}
+
+// apply the volume to b's frame and hand it to every sink in map_item's
+// stack, or hold it back for a crossfade. takes over the reference to b.
+// returns the buffer size
+static int put_buffer(struct GroovePlaylist *playlist, struct SinkMap *map_item,
+        struct GrooveBufferPrivate *b)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    if (apply_gain(p, map_item, b->frame) < 0) {
+        groove_buffer_unref(&b->externals);
+        av_log(NULL, AV_LOG_ERROR, "unable to apply volume: out of memory\n");
+        return -1;
+    }
+    if (playlist->crossfade > 0.0 || map_item->fade_frame)
+        return fade_put(playlist, map_item, b);
+
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) p->decode_head->file;
+    struct GrooveBuffer *buffer = frame_to_groove_buffer(b, p->decode_head, f->audio_clock);
+    int size = buffer->size;
+    send_buffer(map_item, buffer);
+    return size;
+}
+
+// whether the decoded frame is already in the format of the only sink map
+// entry, so that the filter graph would not change it
+static int can_bypass_graph(struct GroovePlaylistPrivate *p, const AVFrame *frame) {
+    if (p->sink_map_count != 1)
+        return 0;
+    struct GrooveSink *example_sink = p->sink_map->stack_head->sink;
+    // the buffersink is what cuts audio into buffer_sample_count pieces
+    if (example_sink->buffer_sample_count != 0)
+        return 0;
+    if (example_sink->disable_resample)
+        return 1;
+    return frame->sample_rate == example_sink->audio_format.sample_rate &&
+        frame->channel_layout == example_sink->audio_format.channel_layout &&
+        frame->format == example_sink->audio_format.sample_fmt;
+}
+
+// push a decoded frame through the filter graph and hand the results to
+// every sink. returns the size of the largest output and sets
+// clock_adjustment to its duration
+static int filter_frame(struct GroovePlaylist *playlist, AVFrame *in_frame,
+        double *clock_adjustment)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    // hand out the decoded frame itself by reference when the graph has
+    // nothing to do. the decoder's frames are reference counted, so this
+    // copies no audio
+    if (can_bypass_graph(p, in_frame)) {
+        struct GrooveBufferPrivate *b = groove_buffer_pool_get(p->buffer_pool);
+        if (!b) {
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate buffer\n");
+            return -1;
+        }
+        if (av_frame_ref(b->frame, in_frame) < 0) {
+            groove_buffer_unref(&b->externals);
+            av_log(NULL, AV_LOG_ERROR, "unable to reference frame\n");
+            return -1;
+        }
+        int data_size = put_buffer(playlist, p->sink_map, b);
+        if (data_size < 0)
+            return -1;
+        struct GrooveSink *example_sink = p->sink_map->stack_head->sink;
+        *clock_adjustment = data_size / (double)example_sink->bytes_per_sec;
+        return data_size;
+    }
+
+    // push the audio data from decoded frame into the filtergraph
+    int err = av_buffersrc_write_frame(p->abuffer_ctx, in_frame);
+    if (err < 0) {
+        av_strerror(err, p->strbuf, sizeof(p->strbuf));
+        av_log(NULL, AV_LOG_ERROR, "error writing frame to buffersrc: %s\n",
+                p->strbuf);
+        return -1;
+    }
+
+    // for each data format in the sink map, pull filtered audio from its
+    // buffersink, turn it into a GrooveBuffer and then increment the ref
+    // count for each sink in that stack.
+    int max_data_size = 0;
+    struct SinkMap *map_item = p->sink_map;
+    *clock_adjustment = 0;
+    while (map_item) {
+        struct GrooveSink *example_sink = map_item->stack_head->sink;
+        int data_size = 0;
+        for (;;) {
+            AVFrame *oframe = p->sink_frame;
+            // audio held back for a crossfade is cut into buffers as it
+            // goes out
+            int whole_frames = example_sink->buffer_sample_count == 0 ||
+                playlist->crossfade > 0.0 || map_item->fade_frame;
+            int err = whole_frames ?
+                av_buffersink_get_frame(map_item->abuffersink_ctx, oframe) :
+                av_buffersink_get_samples(map_item->abuffersink_ctx, oframe, example_sink->buffer_sample_count);
+            if (err == AVERROR_EOF || err == AVERROR(EAGAIN))
+                break;
+            if (err < 0) {
+                av_log(NULL, AV_LOG_ERROR, "error reading buffer from buffersink\n");
+                return -1;
+            }
+            struct GrooveBufferPrivate *b = groove_buffer_pool_get(p->buffer_pool);
+            if (!b) {
+                av_frame_unref(oframe);
+                av_log(NULL, AV_LOG_ERROR, "unable to allocate buffer\n");
+                return -1;
+            }
+            av_frame_move_ref(b->frame, oframe);
+            int size = put_buffer(playlist, map_item, b);
+            if (size < 0)
+                return -1;
+            data_size += size;
+        }
+        if (data_size > max_data_size) {
+            max_data_size = data_size;
+            *clock_adjustment = data_size / (double)example_sink->bytes_per_sec;
+        }
+        map_item = map_item->next;
+    }
+
+    return max_data_size;
 }
 
+// drop the samples of frame, which starts at *clock, that lie outside
+// [start, end) in seconds. when samples are dropped from the front *clock
+// moves to the first one kept. returns the number of samples left, < 0 if
+// out of memory; when that is 0 the frame is untouched.
+static int trim_frame(struct GrooveFilePrivate *f, AVFrame *frame, double *clock,
+        double start, double end)
+{
+    int64_t skip = 0;
+    int64_t keep = frame->nb_samples;
+    if (*clock < start)
+        skip = FFMIN(llrint((start - *clock) * frame->sample_rate), keep);
+    if (*clock + keep / (double)frame->sample_rate > end)
+        keep = FFMAX(llrint((end - *clock) * frame->sample_rate), 0);
+    if (skip >= keep)
+        return 0;
+    if (skip == 0) {
+        frame->nb_samples = keep;
+        return keep;
+    }
+
+    // the decoder may still be using the frame's data, in which case the
+    // samples kept are moved within a copy of it
+    if (av_frame_make_writable(frame) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to trim frame: out of memory\n");
+        return -1;
+    }
+    int channels = f->audio_st->codec->channels;
+    int planar = av_sample_fmt_is_planar(frame->format);
+    int planes = planar ? channels : 1;
+    int sample_size = av_get_bytes_per_sample(frame->format) * (planar ? 1 : channels);
+    for (int i = 0; i < planes; i += 1) {
+        uint8_t *data = frame->extended_data[i];
+        memmove(data, data + skip * sample_size, (keep - skip) * sample_size);
+    }
+    frame->nb_samples = keep - skip;
+    *clock += skip / (double)frame->sample_rate;
+    return frame->nb_samples;
+}
 
 // decode one audio packet and return its uncompressed size
 static int audio_decode_frame(struct GroovePlaylist *playlist, struct GrooveFile *file) {
@@ -179,67 +1075,28 @@ static int audio_decode_frame(struct GroovePlaylist *playlist, struct GrooveFile
             continue;
         }
 
-        // push the audio data from decoded frame into the filtergraph
-        int err = av_buffersrc_write_frame(p->abuffer_ctx, in_frame);
-        if (err < 0) {
-            av_strerror(err, p->strbuf, sizeof(p->strbuf));
-            av_log(NULL, AV_LOG_ERROR, "error writing frame to buffersrc: %s\n",
-                    p->strbuf);
+        // encoder delay and padding, and whatever comes before the seek
+        // target, never reach the sinks, so that items join up gaplessly
+        double start = f->seek_target >= 0 ?
+            FFMAX(f->seek_target, f->gapless_start) : f->gapless_start;
+        int kept = trim_frame(f, in_frame, &f->audio_clock, start, f->gapless_end);
+        if (kept < 0) {
+            av_frame_unref(in_frame);
             return -1;
         }
-
-        // for each data format in the sink map, pull filtered audio from its
-        // buffersink, turn it into a GrooveBuffer and then increment the ref
-        // count for each sink in that stack.
-        struct SinkMap *map_item = p->sink_map;
-        double clock_adjustment = 0;
-        while (map_item) {
-            struct GrooveSink *example_sink = map_item->stack_head->sink;
-            int data_size = 0;
-            for (;;) {
-                AVFrame *oframe = av_frame_alloc();
-                int err = example_sink->buffer_sample_count == 0 ?
-                    av_buffersink_get_frame(map_item->abuffersink_ctx, oframe) :
-                    av_buffersink_get_samples(map_item->abuffersink_ctx, oframe, example_sink->buffer_sample_count);
-                if (err == AVERROR_EOF || err == AVERROR(EAGAIN)) {
-                    av_frame_free(&oframe);
-                    break;
-                }
-                if (err < 0) {
-                    av_frame_free(&oframe);
-                    av_log(NULL, AV_LOG_ERROR, "error reading buffer from buffersink\n");
-                    return -1;
-                }
-                struct GrooveBuffer *buffer = frame_to_groove_buffer(playlist, example_sink, oframe);
-                if (!buffer) {
-                    av_frame_free(&oframe);
-                    return -1;
-                }
-                data_size += buffer->size;
-                struct SinkStack *stack_item = map_item->stack_head;
-                // we hold this reference to avoid cleanups until at least this loop
-                // is done and we call unref after it.
-                groove_buffer_ref(buffer);
-                while (stack_item) {
-                    struct GrooveSink *sink = stack_item->sink;
-                    struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
-                    // as soon as we call groove_queue_put, this buffer could be unref'd.
-                    // so we ref before putting it in the queue, and unref if it failed.
-                    groove_buffer_ref(buffer);
-                    if (groove_queue_put(s->audioq, buffer) < 0) {
-                        av_log(NULL, AV_LOG_ERROR, "unable to put buffer in queue\n");
-                        groove_buffer_unref(buffer);
-                    }
-                    stack_item = stack_item->next;
-                }
-                groove_buffer_unref(buffer);
-            }
-            if (data_size > max_data_size) {
-                max_data_size = data_size;
-                clock_adjustment = data_size / (double)example_sink->bytes_per_sec;
-            }
-            map_item = map_item->next;
+        if (kept == 0) {
+            if (pkt->pts == AV_NOPTS_VALUE)
+                f->audio_clock += in_frame->nb_samples / (double)in_frame->sample_rate;
+            av_frame_unref(in_frame);
+            return 0;
         }
+        f->seek_target = -1.0;
+
+        double clock_adjustment;
+        max_data_size = filter_frame(playlist, in_frame, &clock_adjustment);
+        av_frame_unref(in_frame);
+        if (max_data_size < 0)
+            return -1;
 
         // if no pts, then estimate it
         if (pkt->pts == AV_NOPTS_VALUE)
@@ -249,16 +1106,13 @@ static int audio_decode_frame(struct GroovePlaylist *playlist, struct GrooveFile
     return max_data_size;
 }
 
-// abuffer -> volume -> asplit for each audio format
+// abuffer -> asplit for each audio format
 //                     -> aformat -> abuffersink
 static int init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile *file) {
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
     struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
 
-    // destruct old graph
-    avfilter_graph_free(&p->filter_graph);
-
-    // create new graph
+    // create new graph. the old one stays in graph_cache
     p->filter_graph = avfilter_graph_alloc();
     if (!p->filter_graph) {
         av_log(NULL, AV_LOG_ERROR, "unable to create filter graph: out of memory\n");
@@ -266,7 +1120,6 @@ static int init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile
     }
 
     AVFilter *abuffer = avfilter_get_by_name("abuffer");
-    AVFilter *volume = avfilter_get_by_name("volume");
     AVFilter *asplit = avfilter_get_by_name("asplit");
     AVFilter *aformat = avfilter_get_by_name("aformat");
     AVFilter *abuffersink = avfilter_get_by_name("abuffersink");
@@ -296,32 +1149,6 @@ static int init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile
     // as we create filters, this points the next source to link to
     AVFilterContext *audio_src_ctx = p->abuffer_ctx;
 
-    // save the volume value so we can compare later and check
-    // whether we have to reconstruct the graph
-    p->filter_volume = p->volume;
-    // if volume is not equal to 1.0, create volume filter
-    double vol = p->volume;
-    if (vol > 1.0) vol = 1.0;
-    if (vol < 0.0) vol = 0.0;
-    if (vol == 1.0) {
-        p->volume_ctx = NULL;
-    } else {
-        snprintf(p->strbuf, sizeof(p->strbuf), "volume=%f", vol);
-        av_log(NULL, AV_LOG_INFO, "volume: %s\n", p->strbuf);
-        err = avfilter_graph_create_filter(&p->volume_ctx, volume, NULL,
-                p->strbuf, NULL, p->filter_graph);
-        if (err < 0) {
-            av_log(NULL, AV_LOG_ERROR, "error initializing volume filter\n");
-            return err;
-        }
-        err = avfilter_link(audio_src_ctx, 0, p->volume_ctx, 0);
-        if (err < 0) {
-            av_log(NULL, AV_LOG_ERROR, "unable to link filters\n");
-            return err;
-        }
-        audio_src_ctx = p->volume_ctx;
-    }
-
     // if only one sink, no need for asplit
     if (p->sink_map_count < 2) {
         p->asplit_ctx = NULL;
@@ -398,8 +1225,161 @@ static int init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile
         return err;
     }
 
-    p->rebuild_filter_graph_flag = 0;
+    return 0;
+}
+
+static void free_graph_cache_item(struct FilterGraphCacheItem *item) {
+    avfilter_graph_free(&item->filter_graph);
+    av_free(item->aformat_ctxs);
+    av_free(item->abuffersink_ctxs);
+    av_free(item);
+}
+
+static void free_graph_cache(struct GroovePlaylistPrivate *p) {
+    struct FilterGraphCacheItem *item = p->graph_cache;
+    while (item) {
+        struct FilterGraphCacheItem *next = item->next;
+        free_graph_cache_item(item);
+        item = next;
+    }
+    p->graph_cache = NULL;
+    p->graph_cache_count = 0;
+    p->filter_graph = NULL;
+}
+
+// take ownership of the graph that init_filter_graph just built, put it at
+// the front of graph_cache and evict the least recently used graph if the
+// cache is full
+static int cache_filter_graph(struct GroovePlaylistPrivate *p) {
+    struct FilterGraphCacheItem *item = av_mallocz(sizeof(struct FilterGraphCacheItem));
+    if (item) {
+        item->aformat_ctxs = av_mallocz(p->sink_map_count * sizeof(AVFilterContext *));
+        item->abuffersink_ctxs = av_mallocz(p->sink_map_count * sizeof(AVFilterContext *));
+    }
+    if (!item || (p->sink_map_count > 0 && (!item->aformat_ctxs || !item->abuffersink_ctxs))) {
+        if (item) {
+            av_free(item->aformat_ctxs);
+            av_free(item->abuffersink_ctxs);
+            av_free(item);
+        }
+        avfilter_graph_free(&p->filter_graph);
+        av_log(NULL, AV_LOG_ERROR, "unable to cache filter graph: out of memory\n");
+        return -1;
+    }
+
+    item->filter_graph = p->filter_graph;
+    item->abuffer_ctx = p->abuffer_ctx;
+    item->asplit_ctx = p->asplit_ctx;
+    int i = 0;
+    struct SinkMap *map_item = p->sink_map;
+    while (map_item) {
+        item->aformat_ctxs[i] = map_item->aformat_ctx;
+        item->abuffersink_ctxs[i] = map_item->abuffersink_ctx;
+        i += 1;
+        map_item = map_item->next;
+    }
+    item->in_sample_rate = p->in_sample_rate;
+    item->in_channel_layout = p->in_channel_layout;
+    item->in_sample_fmt = p->in_sample_fmt;
+    item->in_time_base = p->in_time_base;
+
+    item->next = p->graph_cache;
+    p->graph_cache = item;
+    p->graph_cache_count += 1;
+
+    if (p->graph_cache_count > FILTER_GRAPH_CACHE_SIZE) {
+        struct FilterGraphCacheItem *prev = p->graph_cache;
+        while (prev->next->next)
+            prev = prev->next;
+        free_graph_cache_item(prev->next);
+        prev->next = NULL;
+        p->graph_cache_count -= 1;
+    }
+
+    return 0;
+}
+
+// make a cached graph the one in use
+static void use_cached_graph(struct GroovePlaylistPrivate *p, struct FilterGraphCacheItem *item) {
+    p->filter_graph = item->filter_graph;
+    p->abuffer_ctx = item->abuffer_ctx;
+    p->asplit_ctx = item->asplit_ctx;
+    int i = 0;
+    struct SinkMap *map_item = p->sink_map;
+    while (map_item) {
+        map_item->aformat_ctx = item->aformat_ctxs[i];
+        map_item->abuffersink_ctx = item->abuffersink_ctxs[i];
+        i += 1;
+        map_item = map_item->next;
+    }
+    p->in_sample_rate = item->in_sample_rate;
+    p->in_channel_layout = item->in_channel_layout;
+    p->in_sample_fmt = item->in_sample_fmt;
+    p->in_time_base = item->in_time_base;
+}
+
+// push PARK_SILENCE_SAMPLES of silence in the input format through the
+// graph, so that a resampler's history holds nothing of the item that used
+// the graph last. ending the input would flush it too, but for good.
+// returns 0 on success, < 0 on error
+static int flush_resampler_history(struct GroovePlaylistPrivate *p) {
+    AVFrame *frame = av_frame_alloc();
+    if (!frame)
+        return -1;
+    frame->format = p->in_sample_fmt;
+    frame->channel_layout = p->in_channel_layout;
+    frame->sample_rate = p->in_sample_rate;
+    frame->nb_samples = PARK_SILENCE_SAMPLES;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        return -1;
+    }
+    av_samples_set_silence(frame->extended_data, 0, frame->nb_samples,
+            av_get_channel_layout_nb_channels(frame->channel_layout), frame->format);
+    int err = av_buffersrc_write_frame(p->abuffer_ctx, frame);
+    av_frame_free(&frame);
+    return err;
+}
+
+// the graph in use is about to be left for another one. what it still
+// holds belongs to the item that used it last and must not come out at the
+// start of the next item to use it, so a resampler's history is flushed
+// and the audio waiting in the buffersinks is thrown away. the next item
+// to use the graph is then resampled as if silence came before it.
+// returns 0 on success, < 0 on error
+static int park_filter_graph(struct GroovePlaylistPrivate *p) {
+    int resamples = 0;
+    struct SinkMap *map_item = p->sink_map;
+    while (map_item) {
+        struct GrooveSink *example_sink = map_item->stack_head->sink;
+        if (map_item->aformat_ctx && example_sink->audio_format.sample_rate != p->in_sample_rate)
+            resamples = 1;
+        map_item = map_item->next;
+    }
+
+    if (resamples && flush_resampler_history(p) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to flush resampler\n");
+        return -1;
+    }
 
+    AVFrame *frame = p->sink_frame;
+    map_item = p->sink_map;
+    while (map_item) {
+        // the silence comes out in frames as big as the ones pushed in.
+        // the buffersink keeps less than buffer_sample_count samples back,
+        // and hands them out only in pieces of the size asked for
+        struct GrooveSink *example_sink = map_item->stack_head->sink;
+        while (av_buffersink_get_frame(map_item->abuffersink_ctx, frame) >= 0)
+            av_frame_unref(frame);
+        int nb_samples = 1;
+        while (nb_samples * 2 < example_sink->buffer_sample_count)
+            nb_samples *= 2;
+        for (; nb_samples > 0; nb_samples /= 2) {
+            while (av_buffersink_get_samples(map_item->abuffersink_ctx, frame, nb_samples) >= 0)
+                av_frame_unref(frame);
+        }
+        map_item = map_item->next;
+    }
     return 0;
 }
 
@@ -409,19 +1389,51 @@ static int maybe_init_filter_graph(struct GroovePlaylist *playlist, struct Groov
     AVCodecContext *avctx = f->audio_st->codec;
     AVRational time_base = f->audio_st->time_base;
 
-    // if the input format stuff has changed, then we need to re-build the graph
-    if (!p->filter_graph || p->rebuild_filter_graph_flag ||
-        p->in_sample_rate != avctx->sample_rate ||
-        p->in_channel_layout != avctx->channel_layout ||
-        p->in_sample_fmt != avctx->sample_fmt ||
-        p->in_time_base.num != time_base.num ||
-        p->in_time_base.den != time_base.den ||
-        p->volume != p->filter_volume)
+    // none of the cached graphs fit the new sink map
+    if (p->rebuild_filter_graph_flag) {
+        free_graph_cache(p);
+        p->rebuild_filter_graph_flag = 0;
+    }
+
+    // if the input format stuff has changed, then we need another graph
+    if (p->filter_graph &&
+        p->in_sample_rate == avctx->sample_rate &&
+        p->in_channel_layout == avctx->channel_layout &&
+        p->in_sample_fmt == avctx->sample_fmt &&
+        p->in_time_base.num == time_base.num &&
+        p->in_time_base.den == time_base.den)
     {
-        return init_filter_graph(playlist, file);
+        return 0;
     }
 
-    return 0;
+    if (p->filter_graph && park_filter_graph(p) < 0)
+        return -1;
+
+    struct FilterGraphCacheItem **prev = &p->graph_cache;
+    struct FilterGraphCacheItem *item = p->graph_cache;
+    while (item) {
+        if (item->in_sample_rate == avctx->sample_rate &&
+            item->in_channel_layout == avctx->channel_layout &&
+            item->in_sample_fmt == avctx->sample_fmt &&
+            item->in_time_base.num == time_base.num &&
+            item->in_time_base.den == time_base.den)
+        {
+            // move it to the front
+            *prev = item->next;
+            item->next = p->graph_cache;
+            p->graph_cache = item;
+            use_cached_graph(p, item);
+            return 0;
+        }
+        prev = &item->next;
+        item = item->next;
+    }
+
+    if (init_filter_graph(playlist, file) < 0) {
+        avfilter_graph_free(&p->filter_graph);
+        return -1;
+    }
+    return cache_filter_graph(p);
 }
 
 static int every_sink(struct GroovePlaylist *playlist, int (*func)(struct GrooveSink *), int default_value) {
@@ -443,16 +1455,29 @@ static int every_sink(struct GroovePlaylist *playlist, int (*func)(struct Groove
 
 static int sink_is_full(struct GrooveSink *sink) {
     struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
-    return s->audioq_size >= s->min_audioq_size;
+    // a sink that was cut off does not want any more audio
+    return s->cut_off || atomic_load(&s->audioq_size) >= s->min_audioq_size;
 }
 
 static int every_sink_full(struct GroovePlaylist *playlist) {
     return every_sink(playlist, sink_is_full, 1);
 }
 
+static int sink_is_blocking(struct GrooveSink *sink) {
+    struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
+    return sink->overflow_policy == GROOVE_OVERFLOW_BLOCK && !s->cut_off &&
+        s->max_audioq_size > 0 && atomic_load(&s->audioq_size) >= s->max_audioq_size;
+}
+
+// whether a sink at its hard cap holds back decoding for everyone
+static int any_sink_blocking(struct GroovePlaylist *playlist) {
+    return every_sink(playlist, sink_is_blocking, 0);
+}
+
 static int sink_signal_end(struct GrooveSink *sink) {
     struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
-    groove_queue_put(s->audioq, end_of_q_sentinel);
+    if (!s->cut_off)
+        groove_queue_put(s->audioq, end_of_q_sentinel);
     return 0;
 }
 
@@ -474,6 +1499,275 @@ static void every_sink_flush(struct GroovePlaylist *playlist) {
     every_sink(playlist, sink_flush, 0);
 }
 
+static void free_primed_frames(struct PrimedFrame **head) {
+    struct PrimedFrame *node = *head;
+    while (node) {
+        struct PrimedFrame *next = node->next;
+        av_frame_free(&node->frame);
+        av_free(node);
+        node = next;
+    }
+    *head = NULL;
+}
+
+// inputs without a seek callback (see groove_file_open_custom) can only
+// play forward. a seek to the start is accepted as a no-op so that the
+// first play works.
+// other seeks land on or before pos and leave seek_target for
+// audio_decode_frame to drop the audio in between.
+static int seek_file(struct GrooveFilePrivate *f, int64_t pos) {
+    if (f->ic->pb && !f->ic->pb->seekable)
+        return pos == 0 ? 0 : -1;
+
+    f->seek_landing = 0;
+    f->seek_target = -1.0;
+    if (pos == 0)
+        return av_seek_frame(f->ic, f->audio_stream_index, 0, 0);
+
+    double time_base = av_q2d(f->audio_st->time_base);
+    f->seek_target = pos * time_base;
+    f->seek_start = FFMAX(pos - (int64_t)(SEEK_PREROLL / time_base), 0);
+    f->seek_landing = 1;
+    f->seek_untimed = 0;
+    f->seek_retries = 0;
+
+    // the demuxer's generic index only knows the packets it has read so
+    // far. with the seek index added to it, it does not have to read up to
+    // pos first.
+    if (!f->seek_index_applied) {
+        pthread_mutex_lock(&f->seek_mutex);
+        struct GrooveSeekIndex *index = f->seek_index;
+        pthread_mutex_unlock(&f->seek_mutex);
+        if (index) {
+            for (int i = 0; i < index->count; i += 1) {
+                struct GrooveSeekPoint *point = &index->points[i];
+                av_add_index_entry(f->audio_st, point->pos, point->ts, 0, 0, AVINDEX_KEYFRAME);
+            }
+            f->seek_index_applied = 1;
+        }
+    }
+
+    return av_seek_frame(f->ic, f->audio_stream_index, f->seek_start, AVSEEK_FLAG_BACKWARD);
+}
+
+// called with the audio packets after a seek until one has a timestamp.
+// returns 1 if pkt is to be dropped: audio before the first timestamp
+// cannot be placed, and none is needed if the seek overshot the target and
+// has been redone.
+static int check_seek(struct GrooveFilePrivate *f, AVPacket *pkt) {
+    if (pkt->pts == AV_NOPTS_VALUE) {
+        f->seek_untimed += 1;
+        if (f->seek_untimed <= SEEK_MAX_UNTIMED)
+            return 1;
+        // with no idea where the seek landed there is no telling what to
+        // drop
+        f->seek_landing = 0;
+        f->seek_target = -1.0;
+        return 0;
+    }
+
+    f->seek_landing = 0;
+    if (pkt->pts * av_q2d(f->audio_st->time_base) <= f->seek_target || f->seek_start <= 0)
+        return 0;
+
+    // go back by as much as we overshot, or all the way
+    f->seek_retries += 1;
+    if (f->seek_retries > SEEK_MAX_RETRIES)
+        f->seek_start = 0;
+    else
+        f->seek_start = FFMAX(2 * f->seek_start - pkt->pts, 0);
+    if (av_seek_frame(f->ic, f->audio_stream_index, f->seek_start, AVSEEK_FLAG_BACKWARD) < 0) {
+        f->seek_target = -1.0;
+        return 0;
+    }
+    avcodec_flush_buffers(f->audio_st->codec);
+    f->seek_landing = 1;
+    f->seek_untimed = 0;
+    return 1;
+}
+
+// seek file to the beginning and decode its first frames into head.
+// runs on prime_thread without decode_head_mutex; prime_request and
+// prime_take keep decode_thread away from the file in the meantime.
+static int prime_file(struct GroovePlaylistPrivate *p, struct GrooveFile *file,
+        struct PrimedFrame **head)
+{
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
+    AVCodecContext *dec = f->audio_st->codec;
+    AVFrame *in_frame = p->prime_frame;
+
+    if (seek_file(f, 0) < 0)
+        av_log(NULL, AV_LOG_ERROR, "%s: error while seeking\n", f->ic->filename);
+    avcodec_flush_buffers(dec);
+    f->eof = 0;
+
+    struct PrimedFrame **tail = head;
+    int frame_count = 0;
+    double clock = 0;
+    AVPacket pkt;
+    for (int i = 0; i < PRIME_MAX_PACKETS && frame_count < PRIME_FRAME_COUNT; i += 1) {
+        if (atomic_load(&p->prime_abort) || f->abort_request)
+            break;
+        // on error or EOF decode_one_frame will find out for itself
+        if (av_read_frame(f->ic, &pkt) < 0)
+            break;
+        if (pkt.stream_index != f->audio_stream_index) {
+            av_free_packet(&pkt);
+            continue;
+        }
+        if (pkt.pts != AV_NOPTS_VALUE)
+            clock = av_q2d(f->audio_st->time_base) * pkt.pts;
+
+        AVPacket pkt_temp = pkt;
+        while (pkt_temp.size > 0) {
+            int got_frame;
+            int len = avcodec_decode_audio4(dec, in_frame, &got_frame, &pkt_temp);
+            if (len < 0)
+                break;
+            pkt_temp.data += len;
+            pkt_temp.size -= len;
+            if (!got_frame)
+                continue;
+            int kept = trim_frame(f, in_frame, &clock, f->gapless_start, f->gapless_end);
+            if (kept == 0) {
+                clock += in_frame->nb_samples / (double)in_frame->sample_rate;
+                continue;
+            }
+
+            struct PrimedFrame *node = kept < 0 ? NULL : av_mallocz(sizeof(struct PrimedFrame));
+            if (node)
+                node->frame = av_frame_clone(in_frame);
+            if (!node || !node->frame) {
+                av_free(node);
+                av_free_packet(&pkt);
+                av_frame_unref(in_frame);
+                av_log(NULL, AV_LOG_ERROR, "unable to prime file: out of memory\n");
+                return -1;
+            }
+            node->clock = clock;
+            clock += in_frame->nb_samples / (double)in_frame->sample_rate;
+            *tail = node;
+            tail = &node->next;
+            frame_count += 1;
+        }
+        av_free_packet(&pkt);
+    }
+    av_frame_unref(in_frame);
+
+    return frame_count > 0 ? 0 : -1;
+}
+
+// this thread prepares the item after decode_head while decode_thread is
+// still busy with the current one
+static void *prime_thread(void *arg) {
+    struct GroovePlaylistPrivate *p = arg;
+
+    pthread_mutex_lock(&p->prime_mutex);
+    while (!p->abort_request) {
+        if (p->prime_state != PRIME_REQUESTED) {
+            pthread_cond_wait(&p->prime_cond, &p->prime_mutex);
+            continue;
+        }
+        struct GrooveFile *file = p->prime_item->file;
+        p->prime_state = PRIME_BUSY;
+        atomic_store(&p->prime_abort, 0);
+        pthread_mutex_unlock(&p->prime_mutex);
+
+        struct PrimedFrame *head = NULL;
+        int err = prime_file(p, file, &head);
+
+        pthread_mutex_lock(&p->prime_mutex);
+        if (err < 0 || atomic_load(&p->prime_abort)) {
+            free_primed_frames(&head);
+            p->prime_state = PRIME_IDLE;
+            p->prime_item = NULL;
+        } else {
+            p->primed_head = head;
+            p->prime_state = PRIME_READY;
+        }
+        pthread_cond_broadcast(&p->prime_cond);
+    }
+    pthread_mutex_unlock(&p->prime_mutex);
+
+    return NULL;
+}
+
+// ask prime_thread to prepare item, or to drop whatever it has when item is
+// NULL. a prime of some other item is stopped and waited for, so when this
+// returns prime_thread touches no file other than item's.
+static void prime_request(struct GroovePlaylistPrivate *p, struct GroovePlaylistItem *item) {
+    pthread_mutex_lock(&p->prime_mutex);
+    if (item && p->prime_item == item && p->prime_state != PRIME_IDLE) {
+        pthread_mutex_unlock(&p->prime_mutex);
+        return;
+    }
+    while (p->prime_state == PRIME_BUSY) {
+        atomic_store(&p->prime_abort, 1);
+        pthread_cond_wait(&p->prime_cond, &p->prime_mutex);
+    }
+    free_primed_frames(&p->primed_head);
+    p->prime_item = item;
+    p->prime_state = item ? PRIME_REQUESTED : PRIME_IDLE;
+    pthread_cond_broadcast(&p->prime_cond);
+    pthread_mutex_unlock(&p->prime_mutex);
+}
+
+// take over the frames primed for item so that decode_thread can start
+// with them. returns 1 if there were any, otherwise the caller has to seek
+// item's file itself.
+static int prime_take(struct GroovePlaylistPrivate *p, struct GroovePlaylistItem *item) {
+    pthread_mutex_lock(&p->prime_mutex);
+    while (p->prime_item == item && p->prime_state == PRIME_BUSY)
+        pthread_cond_wait(&p->prime_cond, &p->prime_mutex);
+
+    int taken = 0;
+    if (p->prime_item == item) {
+        if (p->prime_state == PRIME_READY) {
+            free_primed_frames(&p->pending_head);
+            p->pending_item = item;
+            p->pending_head = p->primed_head;
+            p->primed_head = NULL;
+            taken = 1;
+        }
+        p->prime_item = NULL;
+        p->prime_state = PRIME_IDLE;
+    }
+    pthread_mutex_unlock(&p->prime_mutex);
+
+    return taken;
+}
+
+// filter the next frame that prime_thread decoded, in place of reading a
+// packet from the file
+static int decode_primed_frame(struct GroovePlaylist *playlist, struct GrooveFile *file) {
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
+
+    // a seek request makes the primed frames useless
+    pthread_mutex_lock(&f->seek_mutex);
+    int seeking = f->seek_pos >= 0;
+    pthread_mutex_unlock(&f->seek_mutex);
+    if (seeking) {
+        free_primed_frames(&p->pending_head);
+        return 0;
+    }
+
+    if (maybe_init_filter_graph(playlist, file) < 0)
+        return -1;
+
+    struct PrimedFrame *node = p->pending_head;
+    p->pending_head = node->next;
+
+    double clock_adjustment;
+    f->audio_clock = node->clock;
+    if (filter_frame(playlist, node->frame, &clock_adjustment) >= 0)
+        f->audio_clock += clock_adjustment;
+
+    av_frame_free(&node->frame);
+    av_free(node);
+    return 0;
+}
+
 static int decode_one_frame(struct GroovePlaylist *playlist, struct GrooveFile *file) {
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
     struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
@@ -499,19 +1793,22 @@ static int decode_one_frame(struct GroovePlaylist *playlist, struct GrooveFile *
         }
     }
 
-    // handle seek requests
+    // handle seek requests. seek_file may take seek_mutex itself
     pthread_mutex_lock(&f->seek_mutex);
-    if (f->seek_pos >= 0) {
-        if (av_seek_frame(f->ic, f->audio_stream_index, f->seek_pos, 0) < 0) {
+    int64_t seek_pos = f->seek_pos;
+    int seek_flush = f->seek_flush;
+    f->seek_pos = -1;
+    pthread_mutex_unlock(&f->seek_mutex);
+    if (seek_pos >= 0) {
+        if (seek_file(f, seek_pos) < 0) {
             av_log(NULL, AV_LOG_ERROR, "%s: error while seeking\n", f->ic->filename);
-        } else if (f->seek_flush) {
+        } else if (seek_flush) {
             every_sink_flush(playlist);
+            every_fade_reset(p);
         }
         avcodec_flush_buffers(f->audio_st->codec);
-        f->seek_pos = -1;
         f->eof = 0;
     }
-    pthread_mutex_unlock(&f->seek_mutex);
 
     if (f->eof) {
         if (f->audio_st->codec->codec->capabilities & CODEC_CAP_DELAY) {
@@ -541,6 +1838,10 @@ static int decode_one_frame(struct GroovePlaylist *playlist, struct GrooveFile *
         av_free_packet(pkt);
         return 0;
     }
+    if (f->seek_landing && check_seek(f, pkt)) {
+        av_free_packet(pkt);
+        return 0;
+    }
     audio_decode_frame(playlist, file);
     av_free_packet(pkt);
     return 0;
@@ -551,7 +1852,7 @@ static void audioq_put(struct GrooveQueue *queue, void *obj) {
     if (buffer == end_of_q_sentinel)
         return;
     struct GrooveSinkPrivate *s = queue->context;
-    s->audioq_size += buffer->size;
+    atomic_fetch_add(&s->audioq_size, buffer->size);
 }
 
 static void audioq_get(struct GrooveQueue *queue, void *obj) {
@@ -560,11 +1861,32 @@ static void audioq_get(struct GrooveQueue *queue, void *obj) {
         return;
     struct GrooveSink *sink = queue->context;
     struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
-    s->audioq_size -= buffer->size;
+    int audioq_size = atomic_fetch_sub(&s->audioq_size, buffer->size) - buffer->size;
+
+    // between the watermarks decode_thread keeps sleeping, so that it
+    // refills in bursts instead of one packet per buffer taken out
+    struct GroovePlaylist *playlist = sink->playlist;
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+    if (audioq_size < s->low_audioq_size)
+        pthread_cond_signal(&p->sink_drain_cond);
+}
+
+static void audioq_get_many(struct GrooveQueue *queue, void **objs, int count) {
+    struct GrooveSink *sink = queue->context;
+    struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
 
+    int size = 0;
+    for (int i = 0; i < count; i += 1) {
+        struct GrooveBuffer *buffer = objs[i];
+        if (buffer != end_of_q_sentinel)
+            size += buffer->size;
+    }
+    int audioq_size = atomic_fetch_sub(&s->audioq_size, size) - size;
+
+    // one wakeup for the whole batch
     struct GroovePlaylist *playlist = sink->playlist;
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
-    if (s->audioq_size < s->min_audioq_size)
+    if (size > 0 && audioq_size < s->low_audioq_size)
         pthread_cond_signal(&p->sink_drain_cond);
 }
 
@@ -574,7 +1896,7 @@ static void audioq_cleanup(struct GrooveQueue *queue, void *obj) {
         return;
     struct GrooveSink *sink = queue->context;
     struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
-    s->audioq_size -= buffer->size;
+    atomic_fetch_sub(&s->audioq_size, buffer->size);
     groove_buffer_unref(buffer);
 }
 
@@ -611,20 +1933,36 @@ static void *decode_thread(void *arg) {
         p->sent_end_of_q = 0;
 
         // if all sinks are filled up, no need to read more
-        if (every_sink_full(playlist)) {
+        if (every_sink_full(playlist) || any_sink_blocking(playlist)) {
             pthread_cond_wait(&p->sink_drain_cond, &p->decode_head_mutex);
             pthread_mutex_unlock(&p->decode_head_mutex);
             continue;
         }
 
+        // keep the item after decode_head primed, unless it reads from the
+        // same file that we are decoding. this waits until a sink wants
+        // audio so that a playlist nobody consumes leaves its files alone
+        struct GroovePlaylistItem *next_item = p->decode_head->next;
+        if (p->decode_head != p->prime_after || next_item != p->prime_next) {
+            p->prime_after = p->decode_head;
+            p->prime_next = next_item;
+            int can_prime = next_item && next_item->file != p->decode_head->file;
+            prime_request(p, can_prime ? next_item : NULL);
+        }
+        if (p->pending_head && p->pending_item != p->decode_head)
+            free_primed_frames(&p->pending_head);
+
         struct GrooveFile *file = p->decode_head->file;
 
         p->volume = p->decode_head->gain * playlist->volume;
 
-        if (decode_one_frame(playlist, file) < 0) {
+        int err = p->pending_head ?
+            decode_primed_frame(playlist, file) : decode_one_frame(playlist, file);
+        if (err < 0) {
+            every_fade_next(playlist, p->decode_head->next != NULL);
             p->decode_head = p->decode_head->next;
-            // seek to beginning of next song
-            if (p->decode_head) {
+            // seek to beginning of next song unless it is already primed
+            if (p->decode_head && !prime_take(p, p->decode_head)) {
                 struct GrooveFile *next_file = p->decode_head->file;
                 struct GrooveFilePrivate *next_f = (struct GrooveFilePrivate *) next_file;
                 pthread_mutex_lock(&next_f->seek_mutex);
@@ -674,8 +2012,10 @@ static int remove_sink_from_map(struct GrooveSink *sink) {
                     map_item->stack_head = next_stack_item;
                 } else {
                     // the stack is empty; delete the map item
+                    fade_free(map_item);
                     av_free(map_item);
                     p->sink_map_count -= 1;
+                    p->rebuild_filter_graph_flag = 1;
                     if (prev_map_item) {
                         prev_map_item->next = next_map_item;
                     } else {
@@ -718,11 +2058,13 @@ static int add_sink_to_map(struct GroovePlaylist *playlist, struct GrooveSink *s
     }
     // we did not find somewhere to put it, so push it onto the stack.
     struct SinkMap *map_entry = av_mallocz(sizeof(struct SinkMap));
-    map_entry->stack_head = stack_entry;
     if (!map_entry) {
         av_free(stack_entry);
         return -1;
     }
+    map_entry->stack_head = stack_entry;
+    map_entry->gain = p->volume > 0.0 ? p->volume : 0.0;
+    map_entry->gain_target = map_entry->gain;
     if (p->sink_map) {
         map_entry->next = p->sink_map;
         p->sink_map = map_entry;
@@ -730,6 +2072,7 @@ static int add_sink_to_map(struct GroovePlaylist *playlist, struct GrooveSink *s
         p->sink_map = map_entry;
     }
     p->sink_map_count += 1;
+    p->rebuild_filter_graph_flag = 1;
     return 0;
 }
 
@@ -768,11 +2111,19 @@ int groove_sink_attach(struct GrooveSink *sink, struct GroovePlaylist *playlist)
 
     s->min_audioq_size = sink->buffer_size * bytes_per_frame;
     av_log(NULL, AV_LOG_INFO, "audio queue size: %d\n", s->min_audioq_size);
+    s->low_audioq_size = (sink->low_buffer_size > 0 ?
+            sink->low_buffer_size : sink->buffer_size / 2) * bytes_per_frame;
+    if (s->low_audioq_size > s->min_audioq_size)
+        s->low_audioq_size = s->min_audioq_size;
+    s->max_audioq_size = sink->max_buffer_size * bytes_per_frame;
+    if (s->max_audioq_size > 0 && s->max_audioq_size < s->min_audioq_size)
+        s->max_audioq_size = s->min_audioq_size;
 
     // add the sink to the entry that matches its audio format
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
 
     pthread_mutex_lock(&p->decode_head_mutex);
+    s->cut_off = 0;
     int err = add_sink_to_map(playlist, sink);
     pthread_cond_signal(&p->sink_drain_cond);
     pthread_mutex_unlock(&p->decode_head_mutex);
@@ -806,6 +2157,21 @@ int groove_sink_buffer_get(struct GrooveSink *sink, struct GrooveBuffer **buffer
     }
 }
 
+int groove_sink_buffer_get_many(struct GrooveSink *sink,
+        struct GrooveBuffer **buffers, int max, int block)
+{
+    struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
+
+    // end_of_q_sentinel is NULL so it comes through as a NULL entry
+    int count = groove_queue_get_many(s->audioq, (void**)buffers, max, block);
+    return count < 0 ? 0 : count;
+}
+
+uint64_t groove_sink_dropped_count(struct GrooveSink *sink) {
+    struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
+    return atomic_load(&s->dropped_count);
+}
+
 int groove_sink_buffer_peek(struct GrooveSink *sink, int block) {
     struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
     return groove_queue_peek(s->audioq, block);
@@ -849,6 +2215,13 @@ struct GroovePlaylist * groove_playlist_create(void) {
     }
     p->sink_drain_cond_inited = 1;
 
+    p->buffer_pool = groove_buffer_pool_create(DEFAULT_BUFFER_POOL_SIZE, 0);
+    if (!p->buffer_pool) {
+        groove_playlist_destroy(playlist);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate buffer pool\n");
+        return NULL;
+    }
+
     p->in_frame = av_frame_alloc();
 
     if (!p->in_frame) {
@@ -857,6 +2230,45 @@ struct GroovePlaylist * groove_playlist_create(void) {
         return NULL;
     }
 
+    p->prime_frame = av_frame_alloc();
+
+    if (!p->prime_frame) {
+        groove_playlist_destroy(playlist);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate frame\n");
+        return NULL;
+    }
+
+    p->sink_frame = av_frame_alloc();
+
+    if (!p->sink_frame) {
+        groove_playlist_destroy(playlist);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate frame\n");
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&p->prime_mutex, NULL) != 0) {
+        groove_playlist_destroy(playlist);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate mutex\n");
+        return NULL;
+    }
+    p->prime_mutex_inited = 1;
+
+    if (pthread_cond_init(&p->prime_cond, NULL) != 0) {
+        groove_playlist_destroy(playlist);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate prime mutex condition\n");
+        return NULL;
+    }
+    p->prime_cond_inited = 1;
+
+    atomic_init(&p->prime_abort, 0);
+
+    if (pthread_create(&p->prime_thread_id, NULL, prime_thread, p) != 0) {
+        groove_playlist_destroy(playlist);
+        av_log(NULL, AV_LOG_ERROR, "unable to create prime thread\n");
+        return NULL;
+    }
+    p->prime_thread_inited = 1;
+
     if (pthread_create(&p->thread_id, NULL, decode_thread, playlist) != 0) {
         groove_playlist_destroy(playlist);
         av_log(NULL, AV_LOG_ERROR, "unable to create playlist thread\n");
@@ -877,10 +2289,23 @@ void groove_playlist_destroy(struct GroovePlaylist *playlist) {
     pthread_cond_signal(&p->sink_drain_cond);
     pthread_join(p->thread_id, NULL);
 
+    if (p->prime_thread_inited) {
+        pthread_mutex_lock(&p->prime_mutex);
+        pthread_cond_signal(&p->prime_cond);
+        pthread_mutex_unlock(&p->prime_mutex);
+        pthread_join(p->prime_thread_id, NULL);
+    }
+
     every_sink(playlist, groove_sink_detach, 0);
 
-    avfilter_graph_free(&p->filter_graph);
+    free_primed_frames(&p->pending_head);
+    free_primed_frames(&p->primed_head);
+
+    free_graph_cache(p);
     av_frame_free(&p->in_frame);
+    av_frame_free(&p->prime_frame);
+    av_frame_free(&p->sink_frame);
+    groove_buffer_pool_destroy(p->buffer_pool);
 
     if (p->decode_head_mutex_inited)
         pthread_mutex_destroy(&p->decode_head_mutex);
@@ -891,6 +2316,12 @@ void groove_playlist_destroy(struct GroovePlaylist *playlist) {
     if (p->sink_drain_cond_inited)
         pthread_cond_destroy(&p->sink_drain_cond);
 
+    if (p->prime_mutex_inited)
+        pthread_mutex_destroy(&p->prime_mutex);
+
+    if (p->prime_cond_inited)
+        pthread_cond_destroy(&p->prime_cond);
+
     av_free(p);
 }
 
@@ -910,12 +2341,17 @@ void groove_playlist_seek(struct GroovePlaylist *playlist, struct GroovePlaylist
     struct GrooveFile * file = item->file;
     struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
 
-    int64_t ts = seconds * f->audio_st->time_base.den / f->audio_st->time_base.num;
+    int64_t ts = llrint(seconds * f->audio_st->time_base.den / f->audio_st->time_base.num);
     if (f->ic->start_time != AV_NOPTS_VALUE)
-        ts += f->ic->start_time;
+        ts += av_rescale_q(f->ic->start_time, AV_TIME_BASE_Q, f->audio_st->time_base);
 
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
 
+    // the scan reads the whole file. done here, decode_thread keeps playing
+    // and nobody waits on decode_head_mutex in the meantime
+    if (f->open_flags & GROOVE_FILE_OPEN_SEEK_INDEX)
+        groove_file_build_seek_index(file);
+
     pthread_mutex_lock(&p->decode_head_mutex);
     pthread_mutex_lock(&f->seek_mutex);
 
@@ -932,6 +2368,9 @@ void groove_playlist_seek(struct GroovePlaylist *playlist, struct GroovePlaylist
 struct GroovePlaylistItem * groove_playlist_insert(struct GroovePlaylist *playlist, struct GrooveFile *file,
         double gain, struct GroovePlaylistItem *next)
 {
+    if (groove_file_open_decoder(file) < 0)
+        return NULL;
+
     struct GroovePlaylistItem * item = av_mallocz(sizeof(struct GroovePlaylistItem));
     if (!item)
         return NULL;
@@ -996,9 +2435,24 @@ void groove_playlist_remove(struct GroovePlaylist *playlist, struct GroovePlayli
 
     pthread_mutex_lock(&p->decode_head_mutex);
 
+    // primed frames of item are of no use anymore
+    if (item == p->pending_item) {
+        free_primed_frames(&p->pending_head);
+        p->pending_item = NULL;
+    }
+
     // if it's currently being played, seek to the next item
     if (item == p->decode_head) {
         p->decode_head = item->next;
+        if (p->decode_head)
+            prime_take(p, p->decode_head);
+    }
+
+    // prime_thread must let go of item before it is freed
+    if (item == p->prime_after || item == p->prime_next) {
+        prime_request(p, NULL);
+        p->prime_after = NULL;
+        p->prime_next = NULL;
     }
 
     if (item->prev) {
@@ -1012,6 +2466,14 @@ void groove_playlist_remove(struct GroovePlaylist *playlist, struct GroovePlayli
         playlist->tail = item->prev;
     }
 
+    // audio held back for a crossfade must not outlive item either
+    struct SinkMap *map_item = p->sink_map;
+    while (map_item) {
+        if (map_item->fade_hold_item == item || map_item->fade_tail_item == item)
+            fade_reset(map_item);
+        map_item = map_item->next;
+    }
+
     // in each sink,
     // we must be absolutely sure to purge the audio buffer queue
     // of references to item before freeing it at the bottom of this method
@@ -1084,6 +2546,29 @@ void groove_playlist_set_volume(struct GroovePlaylist *playlist, double volume)
     pthread_mutex_unlock(&p->decode_head_mutex);
 }
 
+void groove_playlist_set_crossfade(struct GroovePlaylist *playlist,
+        double seconds, int curve)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->decode_head_mutex);
+    playlist->crossfade = seconds > 0.0 ? seconds : 0.0;
+    playlist->crossfade_curve = curve;
+    pthread_mutex_unlock(&p->decode_head_mutex);
+}
+
+void groove_playlist_set_buffer_pool_size(struct GroovePlaylist *playlist, int count) {
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+    groove_buffer_pool_set_max_free(p->buffer_pool, count);
+}
+
+void groove_playlist_buffer_pool_stats(struct GroovePlaylist *playlist,
+        uint64_t *hits, uint64_t *misses)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+    groove_buffer_pool_stats(p->buffer_pool, hits, misses);
+}
+
 int groove_playlist_playing(struct GroovePlaylist *playlist) {
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
     return !p->paused;
@@ -1100,8 +2585,12 @@ struct GrooveSink * groove_sink_create(void) {
     struct GrooveSink *sink = &s->externals;
 
     sink->buffer_size = 8192;
+    sink->overflow_policy = GROOVE_OVERFLOW_BLOCK;
+    atomic_init(&s->audioq_size, 0);
+    atomic_init(&s->dropped_count, 0);
 
-    s->audioq = groove_queue_create();
+    // decode_thread is the only producer for this queue
+    s->audioq = groove_queue_create_ring(SINK_RING_CAPACITY);
 
     if (!s->audioq) {
         groove_sink_destroy(sink);
@@ -1113,6 +2602,7 @@ struct GrooveSink * groove_sink_create(void) {
     s->audioq->cleanup = audioq_cleanup;
     s->audioq->put = audioq_put;
     s->audioq->get = audioq_get;
+    s->audioq->get_many = audioq_get_many;
     s->audioq->purge = audioq_purge;
 
     return sink;
@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "probecache.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/log.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avio.h>
+#include <libavutil/intreadwrite.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the cache file is a header followed by records, all little endian:
+//   magic[8] version:u32
+//   record: length:u32 size:u64 mtime_sec:i64 mtime_nsec:i64 path:str
+//           format_name:str stream_index:i32 codec_id:i32 sample_rate:i32
+//           channels:i32 sample_fmt:i32 bit_rate:i32 block_align:i32
+//           bits_per_coded_sample:i32 frame_size:i32 time_base_num:i32
+//           time_base_den:i32 channel_layout:u64 start_time:i64
+//           duration:i64 extradata:blob tag_count:u32 (key:str value:str)*
+//   str: length:u32 bytes, followed by a 0 that length does not count
+//   blob: length:u32 bytes
+// records loaded from disk are used in place from a read-only mapping.
+#define CACHE_MAGIC "GRVPROBE"
+#define CACHE_VERSION 1
+
+// offset of the path in a record
+#define RECORD_PATH_OFFSET 28
+
+struct CacheSlot {
+    uint32_t hash;
+    uint8_t *record; // NULL if the slot is empty
+    char owned; // whether record was allocated rather than mapped
+};
+
+struct ProbeCache {
+    char *path;
+    uint8_t *map;
+    size_t map_size;
+    struct CacheSlot *slots;
+    int slot_count; // always a power of 2
+    int entry_count;
+    int dirty;
+};
+
+// protects cache and everything it points to
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct ProbeCache *cache = NULL;
+// lets lookups skip the stat call without locking when there is no cache
+static atomic_int cache_is_open;
+
+struct Reader {
+    const uint8_t *p;
+    const uint8_t *end;
+    int error;
+};
+
+static const uint8_t *read_bytes(struct Reader *r, size_t size) {
+    if (r->error || (size_t)(r->end - r->p) < size) {
+        r->error = 1;
+        return NULL;
+    }
+    const uint8_t *p = r->p;
+    r->p += size;
+    return p;
+}
+
+static uint32_t read_u32(struct Reader *r) {
+    const uint8_t *p = read_bytes(r, 4);
+    return p ? AV_RL32(p) : 0;
+}
+
+static uint64_t read_u64(struct Reader *r) {
+    const uint8_t *p = read_bytes(r, 8);
+    return p ? AV_RL64(p) : 0;
+}
+
+static const char *read_str(struct Reader *r) {
+    uint32_t len = read_u32(r);
+    const uint8_t *p = read_bytes(r, (size_t)len + 1);
+    if (!p || p[len] != 0) {
+        r->error = 1;
+        return NULL;
+    }
+    return (const char *) p;
+}
+
+static void write_str(AVIOContext *pb, const char *str) {
+    uint32_t len = strlen(str);
+    avio_wl32(pb, len);
+    avio_write(pb, (const unsigned char *) str, len + 1);
+}
+
+static uint32_t hash_path(const char *path) {
+    uint32_t h = 2166136261u;
+    for (; *path; path += 1)
+        h = (h ^ (uint8_t)*path) * 16777619u;
+    return h;
+}
+
+static const char *record_path(const uint8_t *record) {
+    return (const char *) record + RECORD_PATH_OFFSET + 4;
+}
+
+static struct CacheSlot *find_slot(struct CacheSlot *slots, int slot_count,
+        uint32_t hash, const char *path)
+{
+    int mask = slot_count - 1;
+    for (int i = hash & mask;; i = (i + 1) & mask) {
+        struct CacheSlot *slot = &slots[i];
+        if (!slot->record)
+            return slot;
+        if (slot->hash == hash && strcmp(record_path(slot->record), path) == 0)
+            return slot;
+    }
+}
+
+static int grow_slots(struct ProbeCache *c) {
+    int new_count = c->slot_count ? c->slot_count * 2 : 1024;
+    struct CacheSlot *new_slots = av_mallocz(new_count * sizeof(struct CacheSlot));
+    if (!new_slots)
+        return -1;
+    for (int i = 0; i < c->slot_count; i += 1) {
+        struct CacheSlot *slot = &c->slots[i];
+        if (slot->record)
+            *find_slot(new_slots, new_count, slot->hash, record_path(slot->record)) = *slot;
+    }
+    av_free(c->slots);
+    c->slots = new_slots;
+    c->slot_count = new_count;
+    return 0;
+}
+
+// takes ownership of record if owned is set, even on failure
+static int insert_record(struct ProbeCache *c, uint8_t *record, int owned) {
+    if ((c->entry_count + 1) * 4 > c->slot_count * 3 && grow_slots(c) < 0) {
+        if (owned)
+            av_free(record);
+        return -1;
+    }
+    const char *path = record_path(record);
+    uint32_t hash = hash_path(path);
+    struct CacheSlot *slot = find_slot(c->slots, c->slot_count, hash, path);
+    if (slot->record) {
+        if (slot->owned)
+            av_free(slot->record);
+    } else {
+        c->entry_count += 1;
+    }
+    slot->hash = hash;
+    slot->record = record;
+    slot->owned = owned;
+    return 0;
+}
+
+static void load_records(struct ProbeCache *c) {
+    struct Reader r = { c->map, c->map + c->map_size, 0 };
+    const uint8_t *magic = read_bytes(&r, 8);
+    uint32_t version = read_u32(&r);
+    if (r.error || memcmp(magic, CACHE_MAGIC, 8) != 0 || version != CACHE_VERSION) {
+        av_log(NULL, AV_LOG_WARNING, "%s: not a usable probe cache, starting over\n", c->path);
+        return;
+    }
+    while (r.p < r.end) {
+        uint8_t *record = (uint8_t *) r.p;
+        uint32_t len = read_u32(&r);
+        if (len < RECORD_PATH_OFFSET + 5 || !read_bytes(&r, len - 4)) {
+            av_log(NULL, AV_LOG_WARNING, "%s: truncated probe cache\n", c->path);
+            return;
+        }
+        struct Reader path_reader = { record + RECORD_PATH_OFFSET, record + len, 0 };
+        if (!read_str(&path_reader) || insert_record(c, record, 0) < 0) {
+            av_log(NULL, AV_LOG_WARNING, "%s: corrupt probe cache\n", c->path);
+            return;
+        }
+    }
+}
+
+int groove_probe_cache_open(const char *path) {
+    struct ProbeCache *c = av_mallocz(sizeof(struct ProbeCache));
+    if (!c) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate probe cache\n");
+        return -1;
+    }
+    c->path = av_strdup(path);
+    if (!c->path || grow_slots(c) < 0) {
+        av_free(c->path);
+        av_free(c);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate probe cache\n");
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                c->map = map;
+                c->map_size = st.st_size;
+                load_records(c);
+            }
+        }
+        close(fd);
+    } else if (errno != ENOENT) {
+        av_log(NULL, AV_LOG_WARNING, "%s: unable to read probe cache\n", path);
+    }
+
+    // only one cache is open at a time
+    groove_probe_cache_close();
+
+    pthread_mutex_lock(&cache_mutex);
+    cache = c;
+    atomic_store(&cache_is_open, 1);
+    pthread_mutex_unlock(&cache_mutex);
+    return 0;
+}
+
+static int save_records(struct ProbeCache *c) {
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", c->path) >= sizeof(tmp_path)) {
+        av_log(NULL, AV_LOG_ERROR, "%s: probe cache path too long\n", c->path);
+        return -1;
+    }
+    FILE *out = fopen(tmp_path, "wb");
+    if (!out) {
+        av_log(NULL, AV_LOG_ERROR, "%s: unable to write probe cache\n", tmp_path);
+        return -1;
+    }
+    uint8_t version[4];
+    AV_WL32(version, CACHE_VERSION);
+    int ok = fwrite(CACHE_MAGIC, 8, 1, out) == 1 && fwrite(version, 4, 1, out) == 1;
+    for (int i = 0; ok && i < c->slot_count; i += 1) {
+        uint8_t *record = c->slots[i].record;
+        if (!record)
+            continue;
+        ok = fwrite(record, AV_RL32(record), 1, out) == 1;
+    }
+    if (fclose(out) != 0)
+        ok = 0;
+    // the old file stays mapped until we are done with it; rename does not
+    // disturb the mapping
+    if (!ok || rename(tmp_path, c->path) != 0) {
+        remove(tmp_path);
+        av_log(NULL, AV_LOG_ERROR, "%s: unable to write probe cache\n", c->path);
+        return -1;
+    }
+    return 0;
+}
+
+int groove_probe_cache_close(void) {
+    pthread_mutex_lock(&cache_mutex);
+    struct ProbeCache *c = cache;
+    cache = NULL;
+    atomic_store(&cache_is_open, 0);
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (!c)
+        return 0;
+
+    int err = c->dirty ? save_records(c) : 0;
+
+    for (int i = 0; i < c->slot_count; i += 1) {
+        if (c->slots[i].owned)
+            av_free(c->slots[i].record);
+    }
+    av_free(c->slots);
+    if (c->map)
+        munmap(c->map, c->map_size);
+    av_free(c->path);
+    av_free(c);
+    return err;
+}
+
+static int parse_record(const uint8_t *record, struct GrooveProbeInfo *info) {
+    struct Reader r = { record + RECORD_PATH_OFFSET, record + AV_RL32(record), 0 };
+    read_str(&r);
+
+    memset(info, 0, sizeof(struct GrooveProbeInfo));
+    const char *format_name = read_str(&r);
+    info->stream_index = read_u32(&r);
+    info->codec_id = read_u32(&r);
+    info->sample_rate = read_u32(&r);
+    info->channels = read_u32(&r);
+    info->sample_fmt = read_u32(&r);
+    info->bit_rate = read_u32(&r);
+    info->block_align = read_u32(&r);
+    info->bits_per_coded_sample = read_u32(&r);
+    info->frame_size = read_u32(&r);
+    info->time_base_num = read_u32(&r);
+    info->time_base_den = read_u32(&r);
+    info->channel_layout = read_u64(&r);
+    info->start_time = read_u64(&r);
+    info->duration = read_u64(&r);
+    uint32_t extradata_size = read_u32(&r);
+    const uint8_t *extradata = read_bytes(&r, extradata_size);
+    uint32_t tag_count = read_u32(&r);
+    if (r.error)
+        return -1;
+
+    info->format_name = av_strdup(format_name);
+    if (!info->format_name)
+        return -1;
+    if (extradata_size > 0) {
+        info->extradata = av_mallocz(extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!info->extradata)
+            return -1;
+        memcpy(info->extradata, extradata, extradata_size);
+        info->extradata_size = extradata_size;
+    }
+    for (uint32_t i = 0; i < tag_count; i += 1) {
+        const char *key = read_str(&r);
+        const char *value = read_str(&r);
+        if (r.error || av_dict_set(&info->metadata, key, value, 0) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int groove_probe_cache_lookup(const char *filename, struct GrooveProbeInfo *info) {
+    if (!atomic_load(&cache_is_open))
+        return 0;
+
+    struct stat st;
+    if (stat(filename, &st) != 0)
+        return 0;
+
+    int found = 0;
+    pthread_mutex_lock(&cache_mutex);
+    if (cache) {
+        struct CacheSlot *slot = find_slot(cache->slots, cache->slot_count,
+                hash_path(filename), filename);
+        if (slot->record) {
+            struct Reader r = { slot->record + 4, slot->record + RECORD_PATH_OFFSET, 0 };
+            uint64_t size = read_u64(&r);
+            int64_t mtime_sec = read_u64(&r);
+            int64_t mtime_nsec = read_u64(&r);
+            if (size == st.st_size && mtime_sec == st.st_mtim.tv_sec &&
+                mtime_nsec == st.st_mtim.tv_nsec)
+            {
+                found = parse_record(slot->record, info) >= 0;
+                if (!found)
+                    groove_probe_info_free(info);
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return found;
+}
+
+void groove_probe_cache_store(const char *filename, const struct GrooveProbeInfo *info) {
+    if (!atomic_load(&cache_is_open))
+        return;
+
+    struct stat st;
+    if (stat(filename, &st) != 0)
+        return;
+
+    AVIOContext *pb;
+    if (avio_open_dyn_buf(&pb) < 0)
+        return;
+    avio_wl32(pb, 0); // length, filled in below
+    avio_wl64(pb, st.st_size);
+    avio_wl64(pb, st.st_mtim.tv_sec);
+    avio_wl64(pb, st.st_mtim.tv_nsec);
+    write_str(pb, filename);
+    write_str(pb, info->format_name);
+    avio_wl32(pb, info->stream_index);
+    avio_wl32(pb, info->codec_id);
+    avio_wl32(pb, info->sample_rate);
+    avio_wl32(pb, info->channels);
+    avio_wl32(pb, info->sample_fmt);
+    avio_wl32(pb, info->bit_rate);
+    avio_wl32(pb, info->block_align);
+    avio_wl32(pb, info->bits_per_coded_sample);
+    avio_wl32(pb, info->frame_size);
+    avio_wl32(pb, info->time_base_num);
+    avio_wl32(pb, info->time_base_den);
+    avio_wl64(pb, info->channel_layout);
+    avio_wl64(pb, info->start_time);
+    avio_wl64(pb, info->duration);
+    avio_wl32(pb, info->extradata_size);
+    avio_write(pb, info->extradata, info->extradata_size);
+    avio_wl32(pb, av_dict_count(info->metadata));
+    AVDictionaryEntry *tag = NULL;
+    while ((tag = av_dict_get(info->metadata, "", tag, AV_DICT_IGNORE_SUFFIX))) {
+        write_str(pb, tag->key);
+        write_str(pb, tag->value);
+    }
+    uint8_t *record;
+    int len = avio_close_dyn_buf(pb, &record);
+    if (len <= 0) {
+        av_free(record);
+        return;
+    }
+    AV_WL32(record, len);
+
+    pthread_mutex_lock(&cache_mutex);
+    if (cache) {
+        if (insert_record(cache, record, 1) >= 0)
+            cache->dirty = 1;
+    } else {
+        av_free(record);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void groove_probe_info_free(struct GrooveProbeInfo *info) {
+    av_freep(&info->format_name);
+    av_freep(&info->extradata);
+    info->extradata_size = 0;
+    av_dict_free(&info->metadata);
+}
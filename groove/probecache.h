@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_PROBECACHE_H_INCLUDED
+#define GROOVE_PROBECACHE_H_INCLUDED
+
+#include "groove.h"
+
+#include <libavutil/dict.h>
+
+// what groove_file_open learns by probing a file, enough to open it again
+// without avformat_find_stream_info
+struct GrooveProbeInfo {
+    char *format_name;
+    int stream_index;
+    int codec_id;
+    int sample_rate;
+    int channels;
+    uint64_t channel_layout;
+    int sample_fmt;
+    int bit_rate;
+    int block_align;
+    int bits_per_coded_sample;
+    int frame_size;
+    int time_base_num;
+    int time_base_den;
+    int64_t start_time;
+    int64_t duration;
+    uint8_t *extradata;
+    int extradata_size;
+    // container metadata with the audio stream metadata merged in
+    AVDictionary *metadata;
+};
+
+// returns 1 and fills info if the cache is open and has an entry for
+// filename that matches its current size and modification time.
+// otherwise returns 0. free info with groove_probe_info_free.
+int groove_probe_cache_lookup(const char *filename, struct GrooveProbeInfo *info);
+
+// adds or replaces the entry for filename. does nothing if the cache is
+// not open.
+void groove_probe_cache_store(const char *filename, const struct GrooveProbeInfo *info);
+
+void groove_probe_info_free(struct GrooveProbeInfo *info);
+
+#endif /* GROOVE_PROBECACHE_H_INCLUDED */
@@ -9,6 +9,7 @@
 
 #include <libavutil/mem.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 struct ItemList {
     void *obj;
@@ -22,25 +23,113 @@ struct GrooveQueuePrivate {
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     int abort_request;
+
+    // only used by queues created with groove_queue_create_ring.
+    // the producer owns ring_tail and never takes the mutex unless the ring
+    // is full. everything that consumes (get, peek, flush, purge) holds the
+    // mutex and is the only writer of ring_head.
+    void **ring;
+    size_t ring_mask;
+    atomic_size_t ring_head;
+    atomic_size_t ring_tail;
+    // set by the producer when items spill into first/last. while it is set
+    // every put goes to the list so that ordering is preserved.
+    atomic_int overflow;
+    // set while a consumer is parked on cond
+    atomic_int waiting;
 };
 
+static int queue_init(struct GrooveQueuePrivate *q) {
+    if (pthread_mutex_init(&q->mutex, NULL) != 0)
+        return -1;
+    if (pthread_cond_init(&q->cond, NULL) != 0) {
+        pthread_mutex_destroy(&q->mutex);
+        return -1;
+    }
+    q->externals.cleanup = groove_queue_cleanup_default;
+    return 0;
+}
+
 struct GrooveQueue *groove_queue_create(void) {
     struct GrooveQueuePrivate *q = av_mallocz(sizeof(struct GrooveQueuePrivate));
     if (!q)
         return NULL;
 
-    if (pthread_mutex_init(&q->mutex, NULL) != 0) {
+    if (queue_init(q) < 0) {
         av_free(q);
         return NULL;
     }
-    if (pthread_cond_init(&q->cond, NULL) != 0) {
+    return &q->externals;
+}
+
+struct GrooveQueue *groove_queue_create_ring(int capacity) {
+    struct GrooveQueuePrivate *q = av_mallocz(sizeof(struct GrooveQueuePrivate));
+    if (!q)
+        return NULL;
+
+    // round up to a power of 2 so that indexes can be masked
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+
+    q->ring = av_mallocz(size * sizeof(void *));
+    if (!q->ring) {
         av_free(q);
-        pthread_mutex_destroy(&q->mutex);
         return NULL;
     }
-    struct GrooveQueue *queue = &q->externals;
-    queue->cleanup = groove_queue_cleanup_default;
-    return queue;
+    q->ring_mask = size - 1;
+    atomic_init(&q->ring_head, 0);
+    atomic_init(&q->ring_tail, 0);
+    atomic_init(&q->overflow, 0);
+    atomic_init(&q->waiting, 0);
+
+    if (queue_init(q) < 0) {
+        av_free(q->ring);
+        av_free(q);
+        return NULL;
+    }
+    return &q->externals;
+}
+
+// must be called with the mutex held
+static int ring_empty(struct GrooveQueuePrivate *q) {
+    return atomic_load(&q->ring_head) == atomic_load(&q->ring_tail) && !q->first;
+}
+
+// removes the oldest item from a ring queue. must be called with the mutex held
+static int ring_pop(struct GrooveQueuePrivate *q, void **obj_ptr) {
+    size_t head = atomic_load_explicit(&q->ring_head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->ring_tail, memory_order_acquire);
+    if (head != tail) {
+        *obj_ptr = q->ring[head & q->ring_mask];
+        atomic_store_explicit(&q->ring_head, head + 1, memory_order_release);
+        return 1;
+    }
+
+    // the producer only spills into the list while it is non-empty or the
+    // ring is full, so everything in the list is newer than the ring.
+    struct ItemList *el = q->first;
+    if (!el)
+        return 0;
+    q->first = el->next;
+    if (!q->first) {
+        q->last = NULL;
+        atomic_store_explicit(&q->overflow, 0, memory_order_release);
+    }
+    *obj_ptr = el->obj;
+    av_free(el);
+    return 1;
+}
+
+// parks the consumer until something is put or the queue is aborted.
+// must be called with the mutex held
+static void ring_wait(struct GrooveQueuePrivate *q) {
+    atomic_store(&q->waiting, 1);
+    // the producer checks waiting after publishing ring_tail, so check
+    // again now that waiting is visible to avoid missing the wakeup
+    if (atomic_load(&q->ring_head) == atomic_load(&q->ring_tail))
+        pthread_cond_wait(&q->cond, &q->mutex);
+    atomic_store(&q->waiting, 0);
 }
 
 void groove_queue_flush(struct GrooveQueue *queue) {
@@ -48,6 +137,16 @@ void groove_queue_flush(struct GrooveQueue *queue) {
 
     pthread_mutex_lock(&q->mutex);
 
+    if (q->ring) {
+        void *obj;
+        while (ring_pop(q, &obj)) {
+            if (queue->cleanup)
+                queue->cleanup(queue, obj);
+        }
+        pthread_mutex_unlock(&q->mutex);
+        return;
+    }
+
     struct ItemList *el;
     struct ItemList *el1;
     for (el = q->first; el != NULL; el = el1) {
@@ -67,6 +166,7 @@ void groove_queue_destroy(struct GrooveQueue *queue) {
     struct GrooveQueuePrivate *q = (struct GrooveQueuePrivate *) queue;
     pthread_mutex_destroy(&q->mutex);
     pthread_cond_destroy(&q->cond);
+    av_free(q->ring);
     av_free(q);
 }
 
@@ -91,7 +191,68 @@ void groove_queue_reset(struct GrooveQueue *queue) {
     pthread_mutex_unlock(&q->mutex);
 }
 
+static int ring_put(struct GrooveQueuePrivate *q, void *obj) {
+    struct GrooveQueue *queue = &q->externals;
+
+    size_t tail = atomic_load_explicit(&q->ring_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->ring_head, memory_order_acquire);
+
+    if (!atomic_load_explicit(&q->overflow, memory_order_acquire) &&
+        tail - head <= q->ring_mask)
+    {
+        // the put callback must run before the item is published; once it
+        // is visible the consumer may take it and release it.
+        if (queue->put)
+            queue->put(queue, obj);
+        q->ring[tail & q->ring_mask] = obj;
+        atomic_store(&q->ring_tail, tail + 1);
+
+        if (atomic_load(&q->waiting)) {
+            pthread_mutex_lock(&q->mutex);
+            pthread_cond_signal(&q->cond);
+            pthread_mutex_unlock(&q->mutex);
+        }
+        return 0;
+    }
+
+    // slow path: the ring is full or already spilling into the list
+    struct ItemList *el1 = av_mallocz(sizeof(struct ItemList));
+    if (!el1)
+        return -1;
+    el1->obj = obj;
+
+    pthread_mutex_lock(&q->mutex);
+
+    if (queue->put)
+        queue->put(queue, obj);
+
+    head = atomic_load_explicit(&q->ring_head, memory_order_acquire);
+    if (!q->first && tail - head <= q->ring_mask) {
+        // the consumer caught up while we were waiting for the mutex
+        av_free(el1);
+        q->ring[tail & q->ring_mask] = obj;
+        atomic_store(&q->ring_tail, tail + 1);
+    } else {
+        if (!q->last)
+            q->first = el1;
+        else
+            q->last->next = el1;
+        q->last = el1;
+        atomic_store_explicit(&q->overflow, 1, memory_order_release);
+    }
+
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+
+    return 0;
+}
+
 int groove_queue_put(struct GrooveQueue *queue, void *obj) {
+    struct GrooveQueuePrivate *q = (struct GrooveQueuePrivate *) queue;
+
+    if (q->ring)
+        return ring_put(q, obj);
+
     struct ItemList * el1 = av_mallocz(sizeof(struct ItemList));
 
     if (!el1)
@@ -99,7 +260,6 @@ int groove_queue_put(struct GrooveQueue *queue, void *obj) {
 
     el1->obj = obj;
 
-    struct GrooveQueuePrivate *q = (struct GrooveQueuePrivate *) queue;
     pthread_mutex_lock(&q->mutex);
 
     if (!q->last)
@@ -129,12 +289,14 @@ int groove_queue_peek(struct GrooveQueue *queue, int block) {
             break;
         }
 
-        if (q->first) {
+        if (q->ring ? !ring_empty(q) : q->first != NULL) {
             ret = 1;
             break;
         } else if (!block) {
             ret = 0;
             break;
+        } else if (q->ring) {
+            ring_wait(q);
         } else {
             pthread_cond_wait(&q->cond, &q->mutex);
         }
@@ -157,6 +319,21 @@ int groove_queue_get(struct GrooveQueue *queue, void **obj_ptr, int block) {
             break;
         }
 
+        if (q->ring) {
+            if (ring_pop(q, obj_ptr)) {
+                if (queue->get)
+                    queue->get(queue, *obj_ptr);
+                ret = 1;
+                break;
+            } else if (!block) {
+                ret = 0;
+                break;
+            } else {
+                ring_wait(q);
+            }
+            continue;
+        }
+
         ev1 = q->first;
         if (ev1) {
             q->first = ev1->next;
@@ -182,10 +359,91 @@ int groove_queue_get(struct GrooveQueue *queue, void **obj_ptr, int block) {
     return ret;
 }
 
+// pops up to max items without waiting. must be called with the mutex held
+static int pop_many(struct GrooveQueuePrivate *q, void **objs, int max) {
+    int count = 0;
+    if (q->ring) {
+        while (count < max && ring_pop(q, &objs[count]))
+            count += 1;
+        return count;
+    }
+
+    while (count < max && q->first) {
+        struct ItemList *el = q->first;
+        q->first = el->next;
+        objs[count] = el->obj;
+        av_free(el);
+        count += 1;
+    }
+    if (!q->first)
+        q->last = NULL;
+    return count;
+}
+
+int groove_queue_get_many(struct GrooveQueue *queue, void **objs, int max,
+        int block)
+{
+    int ret;
+
+    struct GrooveQueuePrivate *q = (struct GrooveQueuePrivate *) queue;
+    pthread_mutex_lock(&q->mutex);
+
+    for (;;) {
+        if (q->abort_request) {
+            ret = -1;
+            break;
+        }
+
+        ret = pop_many(q, objs, max);
+        if (ret > 0 || !block || max <= 0) {
+            break;
+        } else if (q->ring) {
+            ring_wait(q);
+        } else {
+            pthread_cond_wait(&q->cond, &q->mutex);
+        }
+    }
+
+    if (ret > 0) {
+        if (queue->get_many) {
+            queue->get_many(queue, objs, ret);
+        } else if (queue->get) {
+            for (int i = 0; i < ret; i += 1)
+                queue->get(queue, objs[i]);
+        }
+    }
+
+    pthread_mutex_unlock(&q->mutex);
+    return ret;
+}
+
+// removes purged items from the ring, compacting the survivors towards the
+// tail so that the producer, which only touches slots past the tail, is
+// never disturbed. must be called with the mutex held
+static void ring_purge(struct GrooveQueuePrivate *q) {
+    struct GrooveQueue *queue = &q->externals;
+    size_t head = atomic_load_explicit(&q->ring_head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->ring_tail, memory_order_acquire);
+    size_t write = tail;
+    for (size_t read = tail; read != head; read -= 1) {
+        void *obj = q->ring[(read - 1) & q->ring_mask];
+        if (queue->purge(queue, obj)) {
+            if (queue->cleanup)
+                queue->cleanup(queue, obj);
+        } else {
+            write -= 1;
+            q->ring[write & q->ring_mask] = obj;
+        }
+    }
+    atomic_store_explicit(&q->ring_head, write, memory_order_release);
+}
+
 void groove_queue_purge(struct GrooveQueue *queue) {
     struct GrooveQueuePrivate *q = (struct GrooveQueuePrivate *) queue;
 
     pthread_mutex_lock(&q->mutex);
+    if (q->ring)
+        ring_purge(q);
     struct ItemList *node = q->first;
     struct ItemList *prev = NULL;
     while (node) {
@@ -213,10 +471,11 @@ void groove_queue_purge(struct GrooveQueue *queue) {
             node = node->next;
         }
     }
+    if (q->ring && !q->first)
+        atomic_store_explicit(&q->overflow, 0, memory_order_release);
     pthread_mutex_unlock(&q->mutex);
 }
 
 void groove_queue_cleanup_default(struct GrooveQueue *queue, void *obj) {
     av_free(obj);
 }
-
@@ -15,10 +15,20 @@ struct GrooveQueue {
     void (*put)(struct GrooveQueue*, void *obj);
     void (*get)(struct GrooveQueue*, void *obj);
     int (*purge)(struct GrooveQueue*, void *obj);
+    // optional. if set, groove_queue_get_many calls this once for the whole
+    // batch instead of calling get for each object
+    void (*get_many)(struct GrooveQueue*, void **objs, int count);
 };
 
 struct GrooveQueue *groove_queue_create(void);
 
+// creates a queue backed by a bounded single-producer ring buffer of at
+// least capacity items. put does not lock or allocate unless the ring is
+// full, in which case items spill into a locked list until the consumer
+// catches up. only one thread may call put at a time. the put callback is
+// called outside of the queue lock, before the item becomes visible.
+struct GrooveQueue *groove_queue_create_ring(int capacity);
+
 void groove_queue_flush(struct GrooveQueue *queue);
 
 void groove_queue_destroy(struct GrooveQueue *queue);
@@ -31,6 +41,12 @@ int groove_queue_put(struct GrooveQueue *queue, void *obj);
 // returns -1 if aborted, 1 if got event, 0 if no event ready
 int groove_queue_get(struct GrooveQueue *queue, void **obj_ptr, int block);
 
+// removes up to max objects under a single lock acquisition.
+// returns -1 if aborted, otherwise the number of objects stored in objs.
+// if block is 1, waits until at least one object is ready
+int groove_queue_get_many(struct GrooveQueue *queue, void **objs, int max,
+        int block);
+
 int groove_queue_peek(struct GrooveQueue *queue, int block);
 
 void groove_queue_purge(struct GrooveQueue *queue);
@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "scanner.h"
+#include "queue.h"
+#include "file.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/log.h>
+#include <libavutil/dict.h>
+#include <pthread.h>
+
+struct GrooveScanResultPrivate {
+    struct GrooveScanResult externals;
+    AVDictionary *metadata;
+};
+
+struct GrooveScannerPrivate {
+    struct GrooveScanner externals;
+    char **paths;
+    int path_count;
+    int path_alloc;
+    struct GrooveQueue *result_queue;
+    pthread_t *threads;
+    int thread_count;
+
+    // scan_mutex applies to variables inside this block.
+    pthread_mutex_t scan_mutex;
+    char scan_mutex_inited;
+    // workers wait on this when the result queue is full
+    pthread_cond_t drain_cond;
+    char drain_cond_inited;
+    int next_path;
+    // results that are queued or being produced. a worker reserves its
+    // slot before opening a file so that memory stays bounded.
+    int result_count;
+    int running_count;
+    int abort_request;
+};
+
+static struct GrooveScanResult *scan_path(struct GrooveScannerPrivate *s, int index) {
+    struct GrooveScanner *scanner = &s->externals;
+    struct GrooveScanResultPrivate *r = av_mallocz(sizeof(struct GrooveScanResultPrivate));
+    if (!r) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate scan result\n");
+        return NULL;
+    }
+    struct GrooveScanResult *result = &r->externals;
+    result->index = index;
+    result->filename = av_strdup(s->paths[index]);
+    if (!result->filename) {
+        av_free(r);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate scan result\n");
+        return NULL;
+    }
+
+    struct GrooveFile *file = groove_file_open_flags(result->filename, scanner->open_flags);
+    if (!file) {
+        result->error = -1;
+        return result;
+    }
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
+
+    result->format_name = av_strdup(groove_file_short_names(file));
+    if (result->format_name) {
+        av_dict_copy(&r->metadata, f->ic->metadata, 0);
+        groove_file_audio_format(file, &result->audio_format);
+        result->duration = groove_file_duration(file);
+    } else {
+        result->error = -1;
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate scan result\n");
+    }
+
+    groove_file_close(file);
+    return result;
+}
+
+static void *scan_thread(void *arg) {
+    struct GrooveScannerPrivate *s = arg;
+    struct GrooveScanner *scanner = &s->externals;
+
+    pthread_mutex_lock(&s->scan_mutex);
+    while (!s->abort_request && s->next_path < s->path_count) {
+        if (s->result_count >= scanner->result_queue_size) {
+            pthread_cond_wait(&s->drain_cond, &s->scan_mutex);
+            continue;
+        }
+        int index = s->next_path;
+        s->next_path += 1;
+        s->result_count += 1;
+        pthread_mutex_unlock(&s->scan_mutex);
+
+        struct GrooveScanResult *result = scan_path(s, index);
+
+        // the queue calls back into scan_mutex, so put without holding it
+        if (result && groove_queue_put(s->result_queue, result) < 0) {
+            groove_scan_result_destroy(result);
+            result = NULL;
+        }
+
+        pthread_mutex_lock(&s->scan_mutex);
+        if (!result)
+            s->result_count -= 1;
+    }
+    s->running_count -= 1;
+    // the last worker out marks the end of the results
+    int send_end = !s->abort_request && s->running_count == 0;
+    pthread_mutex_unlock(&s->scan_mutex);
+
+    if (send_end)
+        groove_queue_put(s->result_queue, NULL);
+
+    return NULL;
+}
+
+static void result_queue_cleanup(struct GrooveQueue* queue, void *obj) {
+    struct GrooveScannerPrivate *s = queue->context;
+    if (!obj)
+        return;
+    pthread_mutex_lock(&s->scan_mutex);
+    s->result_count -= 1;
+    pthread_cond_signal(&s->drain_cond);
+    pthread_mutex_unlock(&s->scan_mutex);
+    groove_scan_result_destroy(obj);
+}
+
+static void result_queue_get(struct GrooveQueue *queue, void *obj) {
+    struct GrooveScannerPrivate *s = queue->context;
+    if (!obj)
+        return;
+    pthread_mutex_lock(&s->scan_mutex);
+    s->result_count -= 1;
+    pthread_cond_signal(&s->drain_cond);
+    pthread_mutex_unlock(&s->scan_mutex);
+}
+
+struct GrooveScanner *groove_scanner_create(void) {
+    struct GrooveScannerPrivate *s = av_mallocz(sizeof(struct GrooveScannerPrivate));
+    if (!s) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate scanner\n");
+        return NULL;
+    }
+
+    struct GrooveScanner *scanner = &s->externals;
+
+    if (pthread_mutex_init(&s->scan_mutex, NULL) != 0) {
+        groove_scanner_destroy(scanner);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
+        return NULL;
+    }
+    s->scan_mutex_inited = 1;
+
+    if (pthread_cond_init(&s->drain_cond, NULL) != 0) {
+        groove_scanner_destroy(scanner);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex condition\n");
+        return NULL;
+    }
+    s->drain_cond_inited = 1;
+
+    s->result_queue = groove_queue_create();
+    if (!s->result_queue) {
+        groove_scanner_destroy(scanner);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate queue\n");
+        return NULL;
+    }
+    s->result_queue->context = scanner;
+    s->result_queue->cleanup = result_queue_cleanup;
+    s->result_queue->get = result_queue_get;
+
+    // set some defaults
+    scanner->worker_count = 4;
+    scanner->result_queue_size = 64;
+    scanner->open_flags = GROOVE_FILE_OPEN_METADATA_ONLY;
+
+    return scanner;
+}
+
+void groove_scanner_destroy(struct GrooveScanner *scanner) {
+    if (!scanner)
+        return;
+
+    struct GrooveScannerPrivate *s = (struct GrooveScannerPrivate *) scanner;
+
+    if (s->threads)
+        groove_scanner_stop(scanner);
+
+    if (s->result_queue)
+        groove_queue_destroy(s->result_queue);
+
+    if (s->scan_mutex_inited)
+        pthread_mutex_destroy(&s->scan_mutex);
+
+    if (s->drain_cond_inited)
+        pthread_cond_destroy(&s->drain_cond);
+
+    for (int i = 0; i < s->path_count; i += 1)
+        av_free(s->paths[i]);
+    av_free(s->paths);
+
+    av_free(s);
+}
+
+int groove_scanner_add(struct GrooveScanner *scanner, const char *filename) {
+    struct GrooveScannerPrivate *s = (struct GrooveScannerPrivate *) scanner;
+
+    if (s->threads) {
+        av_log(NULL, AV_LOG_ERROR, "cannot add paths to a running scanner\n");
+        return -1;
+    }
+
+    if (s->path_count >= s->path_alloc) {
+        int new_alloc = s->path_alloc ? s->path_alloc * 2 : 64;
+        char **new_paths = av_realloc(s->paths, new_alloc * sizeof(char *));
+        if (!new_paths) {
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate scanner paths\n");
+            return -1;
+        }
+        s->paths = new_paths;
+        s->path_alloc = new_alloc;
+    }
+
+    char *path = av_strdup(filename);
+    if (!path) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate scanner path\n");
+        return -1;
+    }
+    s->paths[s->path_count] = path;
+    s->path_count += 1;
+    return 0;
+}
+
+int groove_scanner_start(struct GrooveScanner *scanner) {
+    struct GrooveScannerPrivate *s = (struct GrooveScannerPrivate *) scanner;
+
+    if (s->threads) {
+        av_log(NULL, AV_LOG_ERROR, "scanner already started\n");
+        return -1;
+    }
+
+    groove_queue_reset(s->result_queue);
+    s->next_path = 0;
+    s->result_count = 0;
+    s->abort_request = 0;
+
+    if (s->path_count == 0) {
+        groove_queue_put(s->result_queue, NULL);
+        return 0;
+    }
+
+    int count = scanner->worker_count < 1 ? 1 : scanner->worker_count;
+    if (count > s->path_count)
+        count = s->path_count;
+
+    s->threads = av_mallocz(count * sizeof(pthread_t));
+    if (!s->threads) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate scanner threads\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&s->scan_mutex);
+    for (int i = 0; i < count; i += 1) {
+        if (pthread_create(&s->threads[i], NULL, scan_thread, s) != 0) {
+            av_log(NULL, AV_LOG_ERROR, "unable to create scanner thread\n");
+            pthread_mutex_unlock(&s->scan_mutex);
+            groove_scanner_stop(scanner);
+            return -1;
+        }
+        s->thread_count += 1;
+        s->running_count += 1;
+    }
+    pthread_mutex_unlock(&s->scan_mutex);
+
+    return 0;
+}
+
+void groove_scanner_stop(struct GrooveScanner *scanner) {
+    struct GrooveScannerPrivate *s = (struct GrooveScannerPrivate *) scanner;
+
+    pthread_mutex_lock(&s->scan_mutex);
+    s->abort_request = 1;
+    pthread_cond_broadcast(&s->drain_cond);
+    pthread_mutex_unlock(&s->scan_mutex);
+
+    groove_queue_abort(s->result_queue);
+
+    for (int i = 0; i < s->thread_count; i += 1)
+        pthread_join(s->threads[i], NULL);
+    av_free(s->threads);
+    s->threads = NULL;
+    s->thread_count = 0;
+    s->running_count = 0;
+
+    groove_queue_flush(s->result_queue);
+}
+
+int groove_scanner_result_get(struct GrooveScanner *scanner,
+        struct GrooveScanResult **result, int block)
+{
+    struct GrooveScannerPrivate *s = (struct GrooveScannerPrivate *) scanner;
+
+    if (groove_queue_get(s->result_queue, (void**)result, block) == 1) {
+        return *result ? GROOVE_SCAN_YES : GROOVE_SCAN_END;
+    }
+
+    *result = NULL;
+    return GROOVE_SCAN_NO;
+}
+
+int groove_scanner_result_peek(struct GrooveScanner *scanner, int block) {
+    struct GrooveScannerPrivate *s = (struct GrooveScannerPrivate *) scanner;
+    return groove_queue_peek(s->result_queue, block);
+}
+
+void groove_scan_result_destroy(struct GrooveScanResult *result) {
+    if (!result)
+        return;
+
+    struct GrooveScanResultPrivate *r = (struct GrooveScanResultPrivate *) result;
+    av_dict_free(&r->metadata);
+    av_free(result->format_name);
+    av_free(result->filename);
+    av_free(r);
+}
+
+struct GrooveTag *groove_scan_result_metadata_get(struct GrooveScanResult *result,
+        const char *key, const struct GrooveTag *prev, int flags)
+{
+    struct GrooveScanResultPrivate *r = (struct GrooveScanResultPrivate *) result;
+    const AVDictionaryEntry *e = (const AVDictionaryEntry *) prev;
+    return (struct GrooveTag *) av_dict_get(r->metadata, key, e, flags|AV_DICT_IGNORE_SUFFIX);
+}
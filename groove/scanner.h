@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_SCANNER_H_INCLUDED
+#define GROOVE_SCANNER_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+#include "groove.h"
+
+/* opens and probes a list of files on a pool of threads. results come out
+ * of a queue in the order the files finish, not the order they were added.
+ */
+
+#define GROOVE_SCAN_NO  0
+#define GROOVE_SCAN_YES 1
+#define GROOVE_SCAN_END 2
+
+struct GrooveScanResult {
+    /* all fields read-only */
+
+    /* the path as given to groove_scanner_add */
+    char *filename;
+    /* the order in which the path was added, starting at 0 */
+    int index;
+
+    /* 0 on success, < 0 if the file could not be opened. the fields below
+     * are only set on success.
+     */
+    int error;
+    /* a comma separated list of short names for the format */
+    char *format_name;
+    struct GrooveAudioFormat audio_format;
+    /* same as groove_file_duration */
+    double duration;
+};
+
+struct GrooveScanner {
+    /* how many files to open at once.
+     * groove_scanner_create defaults this to 4
+     */
+    int worker_count;
+
+    /* maximum number of results waiting to be collected. workers stop
+     * opening files while this many are queued.
+     * groove_scanner_create defaults this to 64
+     */
+    int result_queue_size;
+
+    /* flags to pass to groove_file_open_flags.
+     * groove_scanner_create defaults this to GROOVE_FILE_OPEN_METADATA_ONLY
+     */
+    int open_flags;
+};
+
+struct GrooveScanner *groove_scanner_create(void);
+/* stops the scanner if it is running */
+void groove_scanner_destroy(struct GrooveScanner *scanner);
+
+/* add a path to scan. will be strdup'd. paths may only be added while the
+ * scanner is stopped. a stopped scanner starts over from the first path.
+ * return 0 on success, < 0 on error
+ */
+int groove_scanner_add(struct GrooveScanner *scanner, const char *filename);
+
+/* the scanner stays started after GROOVE_SCAN_END until you call
+ * groove_scanner_stop.
+ * return 0 on success, < 0 on error
+ */
+int groove_scanner_start(struct GrooveScanner *scanner);
+/* cancels the scan and waits for the workers to finish the files they
+ * have open. results that have not been collected are thrown away.
+ * a thread blocked in groove_scanner_result_get returns GROOVE_SCAN_NO.
+ */
+void groove_scanner_stop(struct GrooveScanner *scanner);
+
+/* returns < 0 on error, GROOVE_SCAN_NO on aborted (block=1) or no result
+ * ready (block=0), GROOVE_SCAN_YES on result returned, and GROOVE_SCAN_END
+ * once every path has been reported.
+ * result is always set to either a valid GrooveScanResult or NULL. you are
+ * responsible for calling groove_scan_result_destroy on it.
+ */
+int groove_scanner_result_get(struct GrooveScanner *scanner,
+        struct GrooveScanResult **result, int block);
+
+/* returns < 0 on error, 0 on no result ready, 1 on result ready
+ * if block is 1, block until result is ready
+ */
+int groove_scanner_result_peek(struct GrooveScanner *scanner, int block);
+
+void groove_scan_result_destroy(struct GrooveScanResult *result);
+
+/* same as groove_file_metadata_get */
+struct GrooveTag *groove_scan_result_metadata_get(struct GrooveScanResult *result,
+        const char *key, const struct GrooveTag *prev, int flags);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* GROOVE_SCANNER_H_INCLUDED */
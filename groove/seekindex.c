@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "seekindex.h"
+
+#include <libavutil/mem.h>
+
+struct GrooveSeekIndex *groove_seek_index_create(void) {
+    return av_mallocz(sizeof(struct GrooveSeekIndex));
+}
+
+void groove_seek_index_destroy(struct GrooveSeekIndex *index) {
+    if (!index)
+        return;
+    av_free(index->points);
+    av_free(index);
+}
+
+int groove_seek_index_add(struct GrooveSeekIndex *index, int64_t pos, int64_t ts) {
+    if (index->count > 0) {
+        struct GrooveSeekPoint *last = &index->points[index->count - 1];
+        if (pos <= last->pos || ts <= last->ts)
+            return 0;
+    }
+    if (index->count >= index->allocated) {
+        int allocated = index->allocated ? index->allocated * 2 : 256;
+        struct GrooveSeekPoint *points = av_realloc(index->points,
+                allocated * sizeof(struct GrooveSeekPoint));
+        if (!points)
+            return -1;
+        index->points = points;
+        index->allocated = allocated;
+    }
+    struct GrooveSeekPoint *point = &index->points[index->count];
+    point->pos = pos;
+    point->ts = ts;
+    index->count += 1;
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_SEEKINDEX_H_INCLUDED
+#define GROOVE_SEEKINDEX_H_INCLUDED
+
+#include <stdint.h>
+
+// a packet which decoding can start from
+struct GrooveSeekPoint {
+    int64_t pos; // byte offset in the file
+    int64_t ts; // in the time base of the stream
+};
+
+// seek points in order of both pos and ts
+struct GrooveSeekIndex {
+    struct GrooveSeekPoint *points;
+    int count;
+    int allocated;
+};
+
+struct GrooveSeekIndex *groove_seek_index_create(void);
+void groove_seek_index_destroy(struct GrooveSeekIndex *index);
+
+// appends a point. points out of order are ignored.
+// returns 0 on success, < 0 if out of memory
+int groove_seek_index_add(struct GrooveSeekIndex *index, int64_t pos, int64_t ts);
+
+#endif /* GROOVE_SEEKINDEX_H_INCLUDED */
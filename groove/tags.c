@@ -0,0 +1,1202 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "tags.h"
+
+#include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/crc.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define COPY_BUFFER_SIZE (256 * 1024)
+
+// tag regions bigger than this are left to the remux
+#define MAX_TAG_SIZE (64 * 1024 * 1024)
+
+#define FLAC_BLOCK_PADDING 1
+#define FLAC_BLOCK_VORBIS_COMMENT 4
+#define FLAC_BLOCK_LAST 0x80
+#define FLAC_MAX_BLOCK_SIZE ((1 << 24) - 1)
+
+#define ID3V2_HEADER_SIZE 10
+#define ID3V2_MAX_SIZE ((1 << 28) - 1)
+#define ID3V2_ENCODING_ISO8859 0
+#define ID3V2_ENCODING_UTF16BOM 1
+#define ID3V2_ENCODING_UTF8 3
+
+#define OGG_PAGE_HEADER_SIZE 27
+#define OGG_MAX_SEGMENTS 255
+#define OGG_MAX_PAGE_SIZE (OGG_PAGE_HEADER_SIZE + OGG_MAX_SEGMENTS * 256)
+#define OGG_FLAG_CONTINUED 0x01
+#define OGG_FLAG_BOS 0x02
+
+struct TagWriter {
+    const char *filename;
+    AVIOContext *pb;
+    int64_t file_size;
+    AVDictionary *metadata;
+    int padding;
+    int flags;
+};
+
+// a file written next to the original and renamed over it when complete
+struct TempFile {
+    char path[1100];
+    int fd;
+};
+
+// names that libavformat converts between its generic ones and those of
+// the format, on the way in and on the way out
+struct KeyConv {
+    const char *native;
+    const char *generic;
+};
+
+static const struct KeyConv vorbis_comment_conv[] = {
+    { "ALBUMARTIST", "album_artist" },
+    { "TRACKNUMBER", "track" },
+    { "DISCNUMBER",  "disc" },
+    { NULL, NULL },
+};
+
+static const struct KeyConv id3v2_34_conv[] = {
+    { "TALB", "album" },
+    { "TCOM", "composer" },
+    { "TCON", "genre" },
+    { "TCOP", "copyright" },
+    { "TENC", "encoded_by" },
+    { "TIT2", "title" },
+    { "TLAN", "language" },
+    { "TPE1", "artist" },
+    { "TPE2", "album_artist" },
+    { "TPE3", "performer" },
+    { "TPOS", "disc" },
+    { "TPUB", "publisher" },
+    { "TRCK", "track" },
+    { "TSSE", "encoder" },
+    { NULL, NULL },
+};
+
+static const struct KeyConv id3v2_4_conv[] = {
+    { "TDRL", "date" },
+    { "TDRC", "date" },
+    { "TDEN", "creation_time" },
+    { "TSOA", "album-sort" },
+    { "TSOP", "artist-sort" },
+    { "TSOT", "title-sort" },
+    { NULL, NULL },
+};
+
+// text frames written under their own name rather than as TXXX
+static const char id3v2_tags[][5] = {
+    "TALB", "TBPM", "TCOM", "TCON", "TCOP", "TDLY", "TENC", "TEXT",
+    "TFLT", "TIT1", "TIT2", "TIT3", "TKEY", "TLAN", "TLEN", "TMED",
+    "TOAL", "TOFN", "TOLY", "TOPE", "TOWN", "TPE1", "TPE2", "TPE3",
+    "TPE4", "TPOS", "TPUB", "TRCK", "TRSN", "TRSO", "TSRC", "TSSE",
+    "",
+};
+
+static const char id3v2_4_tags[][5] = {
+    "TDEN", "TDOR", "TDRC", "TDRL", "TDTG", "TIPL", "TMCL", "TMOO",
+    "TPRO", "TSOA", "TSOP", "TSOT", "TSST",
+    "",
+};
+
+static const char id3v2_3_tags[][5] = {
+    "TDAT", "TIME", "TORY", "TRDA", "TSIZ", "TYER",
+    "",
+};
+
+enum Mp4ItemKind {
+    MP4_STRING,
+    MP4_TRACK,
+    MP4_DISC,
+    MP4_INT8,
+    MP4_INT32,
+};
+
+struct Mp4Item {
+    uint32_t type;
+    const char *key;
+    enum Mp4ItemKind kind;
+};
+
+// the ilst items the mov demuxer reads into metadata, in the order the
+// muxer writes them
+static const struct Mp4Item mp4_items[] = {
+    { MKTAG(0xa9,'n','a','m'), "title",            MP4_STRING },
+    { MKTAG(0xa9,'A','R','T'), "artist",           MP4_STRING },
+    { MKTAG( 'a','A','R','T'), "album_artist",     MP4_STRING },
+    { MKTAG(0xa9,'w','r','t'), "composer",         MP4_STRING },
+    { MKTAG(0xa9,'a','l','b'), "album",            MP4_STRING },
+    { MKTAG(0xa9,'d','a','y'), "date",             MP4_STRING },
+    { MKTAG(0xa9,'t','o','o'), "encoder",          MP4_STRING },
+    { MKTAG(0xa9,'c','m','t'), "comment",          MP4_STRING },
+    { MKTAG(0xa9,'g','e','n'), "genre",            MP4_STRING },
+    { MKTAG(0xa9,'c','p','y'), "copyright",        MP4_STRING },
+    { MKTAG( 'd','e','s','c'), "description",      MP4_STRING },
+    { MKTAG( 'l','d','e','s'), "synopsis",         MP4_STRING },
+    { MKTAG( 't','v','s','h'), "show",             MP4_STRING },
+    { MKTAG( 't','v','e','n'), "episode_id",       MP4_STRING },
+    { MKTAG( 't','v','n','n'), "network",          MP4_STRING },
+    { MKTAG( 't','r','k','n'), "track",            MP4_TRACK },
+    { MKTAG( 'd','i','s','k'), "disc",             MP4_DISC },
+    { MKTAG( 't','v','e','s'), "episode_sort",     MP4_INT32 },
+    { MKTAG( 't','v','s','n'), "season_number",    MP4_INT32 },
+    { MKTAG( 's','t','i','k'), "media_type",       MP4_INT8 },
+    { MKTAG( 'h','d','v','d'), "hd_video",         MP4_INT8 },
+    { MKTAG( 'p','g','a','p'), "gapless_playback", MP4_INT8 },
+    { 0, NULL, MP4_STRING },
+};
+
+// other items the demuxer reads into the same names. they are replaced by
+// the ones above.
+static const uint32_t mp4_alias_items[] = {
+    MKTAG(0xa9,'a','u','t'),
+    MKTAG( 'c','p','r','t'),
+    MKTAG(0xa9,'i','n','f'),
+    MKTAG(0xa9,'s','w','r'),
+    MKTAG(0xa9,'e','n','c'),
+    MKTAG( 'g','n','r','e'),
+    0,
+};
+
+struct Mp4Atom {
+    int64_t offset;
+    int64_t size;
+    uint32_t type;
+    int header_size;
+};
+
+struct OggPage {
+    int flags;
+    uint32_t serial;
+    uint32_t sequence;
+    int segment_count;
+    uint8_t segments[OGG_MAX_SEGMENTS];
+    int data_size;
+    int size; // header, segment table and data
+};
+
+static const char *native_key(const struct KeyConv *conv, const char *key) {
+    for (; conv->native; conv += 1) {
+        if (!av_strcasecmp(key, conv->generic))
+            return conv->native;
+    }
+    return key;
+}
+
+static void put_zeros(AVIOContext *out, int64_t count) {
+    static const uint8_t zeros[4096];
+    while (count > 0) {
+        int size = FFMIN(count, (int64_t) sizeof(zeros));
+        avio_write(out, zeros, size);
+        count -= size;
+    }
+}
+
+// reads size bytes at offset into a new buffer, NULL on failure
+static uint8_t *read_at(struct TagWriter *w, int64_t offset, int64_t size) {
+    if (size < 0 || size > MAX_TAG_SIZE)
+        return NULL;
+    uint8_t *buf = av_malloc(size + 1);
+    if (!buf)
+        return NULL;
+    if (avio_seek(w->pb, offset, SEEK_SET) < 0 || avio_read(w->pb, buf, size) != size) {
+        av_free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+// writes all of data, at offset or at the current position if offset < 0
+static int write_all(int fd, int64_t offset, const uint8_t *data, int64_t size) {
+    while (size > 0) {
+        ssize_t n = offset < 0 ? write(fd, data, size) : pwrite(fd, data, size, offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        size -= n;
+        if (offset >= 0)
+            offset += n;
+    }
+    return 0;
+}
+
+// overwrites size bytes at offset, leaving the rest of the file alone
+static int write_at(struct TagWriter *w, int64_t offset, const uint8_t *data, int size) {
+    int fd = open(w->filename, O_WRONLY);
+    if (fd < 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s: unable to open for writing\n", w->filename);
+        return -1;
+    }
+    int err = write_all(fd, offset, data, size);
+    if (close(fd) != 0)
+        err = -1;
+    if (err < 0)
+        av_log(NULL, AV_LOG_ERROR, "%s: error writing tags\n", w->filename);
+    return err;
+}
+
+static int temp_open(struct TempFile *tmp, const char *filename) {
+    int len = snprintf(tmp->path, sizeof(tmp->path), "%s.tmpXXXXXX", filename);
+    if (len < 0 || len >= (int) sizeof(tmp->path)) {
+        av_log(NULL, AV_LOG_ERROR, "could not create temp file - filename too long\n");
+        return -1;
+    }
+    tmp->fd = mkstemp(tmp->path);
+    if (tmp->fd < 0) {
+        av_log(NULL, AV_LOG_ERROR, "could not create temp file for %s\n", filename);
+        return -1;
+    }
+    // mkstemp makes the file private; keep the original's permissions
+    struct stat st;
+    if (stat(filename, &st) == 0)
+        fchmod(tmp->fd, st.st_mode & 07777);
+    return 0;
+}
+
+static void temp_discard(struct TempFile *tmp) {
+    close(tmp->fd);
+    if (remove(tmp->path) != 0)
+        av_log(NULL, AV_LOG_WARNING, "Error deleting temp file during cleanup\n");
+}
+
+static int temp_commit(struct TempFile *tmp, const char *filename) {
+    if (close(tmp->fd) != 0) {
+        remove(tmp->path);
+        av_log(NULL, AV_LOG_ERROR, "error writing temp file\n");
+        return -1;
+    }
+    if (rename(tmp->path, filename) != 0) {
+        remove(tmp->path);
+        av_log(NULL, AV_LOG_ERROR, "error renaming tmp file to original file\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int temp_write(struct TempFile *tmp, const uint8_t *data, int64_t size) {
+    if (write_all(tmp->fd, -1, data, size) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "error writing temp file\n");
+        return -1;
+    }
+    return 0;
+}
+
+// copies [start, end) of the original to the temp file
+static int temp_copy(struct TempFile *tmp, AVIOContext *pb, int64_t start, int64_t end) {
+    uint8_t *buf = av_malloc(COPY_BUFFER_SIZE);
+    if (!buf)
+        return -1;
+    if (avio_seek(pb, start, SEEK_SET) < 0) {
+        av_free(buf);
+        return -1;
+    }
+    while (start < end) {
+        int size = avio_read(pb, buf, FFMIN(end - start, COPY_BUFFER_SIZE));
+        if (size <= 0 || temp_write(tmp, buf, size) < 0) {
+            av_free(buf);
+            return -1;
+        }
+        start += size;
+    }
+    av_free(buf);
+    return 0;
+}
+
+// writes head, then the original file from offset on, over the original
+static int rewrite_file(struct TagWriter *w, const uint8_t *head, int head_size, int64_t offset) {
+    struct TempFile tmp;
+    if (temp_open(&tmp, w->filename) < 0)
+        return -1;
+    if (temp_write(&tmp, head, head_size) < 0 ||
+        temp_copy(&tmp, w->pb, offset, w->file_size) < 0)
+    {
+        temp_discard(&tmp);
+        return -1;
+    }
+    return temp_commit(&tmp, w->filename);
+}
+
+// the body of a Vorbis comment, as libavformat's flac and ogg muxers write
+// it, keeping the vendor string of the file
+static void put_vorbis_comment(AVIOContext *out, const uint8_t *vendor, int vendor_len,
+        AVDictionary *metadata)
+{
+    if (!vendor) {
+        vendor = (const uint8_t *) LIBAVFORMAT_IDENT;
+        vendor_len = strlen(LIBAVFORMAT_IDENT);
+    }
+    avio_wl32(out, vendor_len);
+    avio_write(out, vendor, vendor_len);
+    avio_wl32(out, av_dict_count(metadata));
+    AVDictionaryEntry *tag = NULL;
+    while ((tag = av_dict_get(metadata, "", tag, AV_DICT_IGNORE_SUFFIX))) {
+        const char *key = native_key(vorbis_comment_conv, tag->key);
+        int key_len = strlen(key);
+        int value_len = strlen(tag->value);
+        avio_wl32(out, key_len + 1 + value_len);
+        avio_write(out, (const uint8_t *) key, key_len);
+        avio_w8(out, '=');
+        avio_write(out, (const uint8_t *) tag->value, value_len);
+    }
+}
+
+// finds the vendor string in a Vorbis comment body of size bytes
+static const uint8_t *vorbis_comment_vendor(const uint8_t *body, int size, int *vendor_len) {
+    if (size < 4)
+        return NULL;
+    uint32_t len = AV_RL32(body);
+    if (len > size - 4)
+        return NULL;
+    *vendor_len = len;
+    return body + 4;
+}
+
+static void put_flac_block_header(AVIOContext *out, int type, int size) {
+    avio_w8(out, type);
+    avio_wb24(out, size);
+}
+
+// flac metadata blocks come right after the "fLaC" marker. the new
+// Vorbis comment goes after all the blocks we keep, followed by a padding
+// block with whatever room is left.
+static int write_flac(struct TagWriter *w) {
+    uint8_t header[4];
+    if (avio_seek(w->pb, 0, SEEK_SET) < 0 || avio_read(w->pb, header, 4) != 4 ||
+        memcmp(header, "fLaC", 4) != 0)
+    {
+        return 0;
+    }
+
+    int64_t region_end = 4;
+    for (;;) {
+        if (avio_seek(w->pb, region_end, SEEK_SET) < 0 || avio_read(w->pb, header, 4) != 4)
+            return 0;
+        region_end += 4 + AV_RB24(header + 1);
+        if (region_end > w->file_size)
+            return 0;
+        if (header[0] & FLAC_BLOCK_LAST)
+            break;
+    }
+    int64_t region_size = region_end - 4;
+    uint8_t *region = read_at(w, 4, region_size);
+    if (!region)
+        return 0;
+
+    AVIOContext *out;
+    if (avio_open_dyn_buf(&out) < 0) {
+        av_free(region);
+        return -1;
+    }
+
+    // everything but the Vorbis comment and padding stays as it is
+    const uint8_t *vendor = NULL;
+    int vendor_len = 0;
+    for (int64_t pos = 0; pos < region_size;) {
+        int type = region[pos] & ~FLAC_BLOCK_LAST;
+        int size = AV_RB24(region + pos + 1);
+        if (type == FLAC_BLOCK_VORBIS_COMMENT) {
+            if (!vendor)
+                vendor = vorbis_comment_vendor(region + pos + 4, size, &vendor_len);
+        } else if (type != FLAC_BLOCK_PADDING) {
+            put_flac_block_header(out, type, size);
+            avio_write(out, region + pos + 4, size);
+        }
+        pos += 4 + size;
+    }
+
+    AVIOContext *comment;
+    if (avio_open_dyn_buf(&comment) < 0) {
+        uint8_t *data;
+        avio_close_dyn_buf(out, &data);
+        av_free(data);
+        av_free(region);
+        return -1;
+    }
+    put_vorbis_comment(comment, vendor, vendor_len, w->metadata);
+    uint8_t *comment_data;
+    int comment_size = avio_close_dyn_buf(comment, &comment_data);
+    av_free(region);
+
+    int64_t fixed_size = avio_tell(out) + 4 + comment_size;
+    int64_t room = region_size - fixed_size;
+    int in_place = (w->flags & GROOVE_TAGS_IN_PLACE) &&
+        (room == 0 || (room >= 4 && room - 4 <= FLAC_MAX_BLOCK_SIZE));
+    // < 0 for no padding block
+    int64_t padding = in_place ? room - 4 :
+        w->padding > 0 ? FFMIN(w->padding, FLAC_MAX_BLOCK_SIZE) : -1;
+
+    int ret = 0;
+    if (comment_size > FLAC_MAX_BLOCK_SIZE || (!in_place && !(w->flags & GROOVE_TAGS_REWRITE))) {
+        av_free(comment_data);
+        uint8_t *data;
+        avio_close_dyn_buf(out, &data);
+        av_free(data);
+        return 0;
+    }
+
+    int last = padding < 0 ? FLAC_BLOCK_LAST : 0;
+    put_flac_block_header(out, FLAC_BLOCK_VORBIS_COMMENT | last, comment_size);
+    avio_write(out, comment_data, comment_size);
+    av_free(comment_data);
+    if (padding >= 0) {
+        put_flac_block_header(out, FLAC_BLOCK_PADDING | FLAC_BLOCK_LAST, padding);
+        put_zeros(out, padding);
+    }
+    uint8_t *data;
+    int size = avio_close_dyn_buf(out, &data);
+
+    if (in_place) {
+        ret = write_at(w, 4, data, size);
+    } else {
+        // the marker goes in front of the blocks
+        uint8_t *head = av_malloc(4 + size);
+        if (!head) {
+            av_free(data);
+            return -1;
+        }
+        memcpy(head, "fLaC", 4);
+        memcpy(head + 4, data, size);
+        ret = rewrite_file(w, head, 4 + size, region_end);
+        av_free(head);
+    }
+    av_free(data);
+    return ret < 0 ? -1 : 1;
+}
+
+static int string_is_ascii(const char *str) {
+    while (*str && (uint8_t) *str < 128)
+        str += 1;
+    return !*str;
+}
+
+// sizes in ID3v2 are syncsafe: 7 bits to a byte
+static void set_id3v2_size(uint8_t *buf, int size) {
+    buf[0] = size >> 21 & 0x7f;
+    buf[1] = size >> 14 & 0x7f;
+    buf[2] = size >> 7  & 0x7f;
+    buf[3] = size       & 0x7f;
+}
+
+static void put_id3v2_size(AVIOContext *out, int size) {
+    uint8_t buf[4];
+    set_id3v2_size(buf, size);
+    avio_write(out, buf, 4);
+}
+
+static int read_id3v2_size(const uint8_t *buf) {
+    return (buf[0] & 0x7f) << 21 | (buf[1] & 0x7f) << 14 | (buf[2] & 0x7f) << 7 | (buf[3] & 0x7f);
+}
+
+static void put_id3v2_string(AVIOContext *out, const char *str, int encoding) {
+    if (encoding == ID3V2_ENCODING_UTF16BOM) {
+        avio_wl16(out, 0xfeff);
+        avio_put_str16le(out, str);
+    } else {
+        avio_put_str(out, str);
+    }
+}
+
+// a text frame holding one string, or two for TXXX. same encodings as
+// libavformat: UTF-16 in version 3 unless the text is ASCII, else UTF-8
+static int put_id3v2_text_frame(AVIOContext *out, int version, uint32_t id,
+        const char *str1, const char *str2)
+{
+    AVIOContext *body;
+    if (avio_open_dyn_buf(&body) < 0)
+        return -1;
+    int encoding = version == 3 ? ID3V2_ENCODING_UTF16BOM : ID3V2_ENCODING_UTF8;
+    if (encoding == ID3V2_ENCODING_UTF16BOM && string_is_ascii(str1) &&
+        (!str2 || string_is_ascii(str2)))
+    {
+        encoding = ID3V2_ENCODING_ISO8859;
+    }
+    avio_w8(body, encoding);
+    put_id3v2_string(body, str1, encoding);
+    if (str2)
+        put_id3v2_string(body, str2, encoding);
+    uint8_t *data;
+    int size = avio_close_dyn_buf(body, &data);
+
+    avio_wb32(out, id);
+    // version 3 frame sizes are not syncsafe
+    if (version == 3)
+        avio_wb32(out, size);
+    else
+        put_id3v2_size(out, size);
+    avio_wb16(out, 0);
+    avio_write(out, data, size);
+    av_free(data);
+    return 0;
+}
+
+static int is_id3v2_tag(const char *key, const char table[][5]) {
+    if (key[0] != 'T' || strlen(key) != 4)
+        return 0;
+    for (int i = 0; table[i][0]; i += 1) {
+        if (!strcmp(key, table[i]))
+            return 1;
+    }
+    return 0;
+}
+
+static int put_id3v2_metadata(AVIOContext *out, int version, AVDictionary *metadata) {
+    AVDictionaryEntry *tag = NULL;
+    while ((tag = av_dict_get(metadata, "", tag, AV_DICT_IGNORE_SUFFIX))) {
+        const char *key = native_key(id3v2_34_conv, tag->key);
+        if (version == 4)
+            key = native_key(id3v2_4_conv, key);
+        // the demuxer reads TYER of version 3 tags as the date. put a plain
+        // year back where it came from.
+        if (version == 3 && !av_strcasecmp(key, "date") && strlen(tag->value) == 4 &&
+            strspn(tag->value, "0123456789") == 4)
+        {
+            key = "TYER";
+        }
+        int err;
+        if (is_id3v2_tag(key, id3v2_tags) ||
+            is_id3v2_tag(key, version == 3 ? id3v2_3_tags : id3v2_4_tags))
+        {
+            err = put_id3v2_text_frame(out, version, AV_RB32(key), tag->value, NULL);
+        } else {
+            err = put_id3v2_text_frame(out, version, MKBETAG('T','X','X','X'), key, tag->value);
+        }
+        if (err < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// the demuxer reads text frames into metadata. those are written anew and
+// all other frames, pictures and such, are kept as they are. version 2.2
+// tags and tags using unsynchronisation or an extended header are left to
+// the remux.
+static int write_id3v2(struct TagWriter *w) {
+    uint8_t header[ID3V2_HEADER_SIZE];
+    if (avio_seek(w->pb, 0, SEEK_SET) < 0 || avio_read(w->pb, header, sizeof(header)) != sizeof(header))
+        return 0;
+
+    int version = 4;
+    int64_t tag_size = 0;
+    int64_t tag_end = 0;
+    uint8_t *body = NULL;
+    if (!memcmp(header, "ID3", 3)) {
+        version = header[3];
+        // unsynchronisation, extended header and footer
+        if ((version != 3 && version != 4) || (header[5] & 0xd0))
+            return 0;
+        tag_size = read_id3v2_size(header + 6);
+        tag_end = ID3V2_HEADER_SIZE + tag_size;
+        // the demuxer reads a tag that follows right away as well
+        uint8_t next[3];
+        if (avio_seek(w->pb, tag_end, SEEK_SET) < 0 || avio_read(w->pb, next, 3) != 3 ||
+            !memcmp(next, "ID3", 3))
+        {
+            return 0;
+        }
+        body = read_at(w, ID3V2_HEADER_SIZE, tag_size);
+        if (!body)
+            return 0;
+    }
+
+    AVIOContext *out;
+    if (avio_open_dyn_buf(&out) < 0) {
+        av_free(body);
+        return -1;
+    }
+    avio_write(out, (const uint8_t *) "ID3", 3);
+    avio_w8(out, version);
+    avio_w8(out, 0);
+    avio_w8(out, 0);
+    put_id3v2_size(out, 0); // filled in below
+    int err = put_id3v2_metadata(out, version, w->metadata);
+
+    int64_t pos = 0;
+    while (err >= 0 && pos + ID3V2_HEADER_SIZE <= tag_size && body[pos]) {
+        const uint8_t *frame = body + pos;
+        int64_t size = version == 3 ? AV_RB32(frame + 4) : read_id3v2_size(frame + 4);
+        if (size > tag_size - pos - ID3V2_HEADER_SIZE) {
+            err = -1;
+            break;
+        }
+        if (frame[0] != 'T')
+            avio_write(out, frame, ID3V2_HEADER_SIZE + size);
+        pos += ID3V2_HEADER_SIZE + size;
+    }
+    av_free(body);
+
+    int64_t frames_size = avio_tell(out) - ID3V2_HEADER_SIZE;
+    int in_place = (w->flags & GROOVE_TAGS_IN_PLACE) && tag_end > 0 && frames_size <= tag_size;
+    int64_t new_size = in_place ? tag_size : frames_size + w->padding;
+    if (err < 0 || new_size > ID3V2_MAX_SIZE || (!in_place && !(w->flags & GROOVE_TAGS_REWRITE))) {
+        uint8_t *data;
+        avio_close_dyn_buf(out, &data);
+        av_free(data);
+        return 0;
+    }
+    put_zeros(out, new_size - frames_size);
+    uint8_t *data;
+    int size = avio_close_dyn_buf(out, &data);
+    set_id3v2_size(data + 6, new_size);
+
+    int ret = in_place ? write_at(w, 0, data, size) : rewrite_file(w, data, size, tag_end);
+    av_free(data);
+    return ret < 0 ? -1 : 1;
+}
+
+static int read_mp4_atom(AVIOContext *pb, int64_t offset, int64_t end, struct Mp4Atom *atom) {
+    if (offset + 8 > end || avio_seek(pb, offset, SEEK_SET) < 0)
+        return -1;
+    atom->offset = offset;
+    atom->size = avio_rb32(pb);
+    atom->type = avio_rl32(pb);
+    atom->header_size = 8;
+    if (atom->size == 1) {
+        atom->size = avio_rb64(pb);
+        atom->header_size = 16;
+    } else if (atom->size == 0) {
+        // extends to the end of its parent
+        atom->size = end - offset;
+    }
+    if (atom->size < atom->header_size || atom->size > end - offset)
+        return -1;
+    return 0;
+}
+
+static int find_mp4_atom(AVIOContext *pb, int64_t offset, int64_t end, uint32_t type,
+        struct Mp4Atom *atom)
+{
+    while (read_mp4_atom(pb, offset, end, atom) >= 0) {
+        if (atom->type == type)
+            return 0;
+        offset += atom->size;
+    }
+    return -1;
+}
+
+static void put_mp4_data_item(AVIOContext *out, uint32_t type, int data_type,
+        const uint8_t *data, int size)
+{
+    avio_wb32(out, 8 + 16 + size);
+    avio_wl32(out, type);
+    avio_wb32(out, 16 + size);
+    avio_wl32(out, MKTAG('d','a','t','a'));
+    avio_wb32(out, data_type);
+    avio_wb32(out, 0); // locale
+    avio_write(out, data, size);
+}
+
+static void put_mp4_items(AVIOContext *out, AVDictionary *metadata) {
+    for (const struct Mp4Item *item = mp4_items; item->key; item += 1) {
+        AVDictionaryEntry *tag = av_dict_get(metadata, item->key, NULL, 0);
+        if (!tag || !tag->value[0])
+            continue;
+        uint8_t buf[8] = { 0 };
+        int number = atoi(tag->value);
+        switch (item->kind) {
+            case MP4_STRING:
+                put_mp4_data_item(out, item->type, 1, (const uint8_t *) tag->value,
+                        strlen(tag->value));
+                break;
+            case MP4_TRACK:
+            case MP4_DISC:
+            {
+                // "number/total"
+                const char *slash = strchr(tag->value, '/');
+                if (number <= 0)
+                    break;
+                AV_WB16(buf + 2, number);
+                AV_WB16(buf + 4, slash ? atoi(slash + 1) : 0);
+                put_mp4_data_item(out, item->type, 0, buf, item->kind == MP4_TRACK ? 8 : 6);
+                break;
+            }
+            case MP4_INT8:
+                buf[0] = number;
+                put_mp4_data_item(out, item->type, 21, buf, 1);
+                break;
+            case MP4_INT32:
+                AV_WB32(buf, number);
+                put_mp4_data_item(out, item->type, 21, buf, 4);
+                break;
+        }
+    }
+}
+
+static int is_mp4_metadata_item(uint32_t type) {
+    for (const struct Mp4Item *item = mp4_items; item->key; item += 1) {
+        if (item->type == type)
+            return 1;
+    }
+    for (const uint32_t *alias = mp4_alias_items; *alias; alias += 1) {
+        if (*alias == type)
+            return 1;
+    }
+    return 0;
+}
+
+static void put_mp4_free(AVIOContext *out, int64_t size) {
+    avio_wb32(out, size);
+    avio_wl32(out, MKTAG('f','r','e','e'));
+    put_zeros(out, size - 8);
+}
+
+// iTunes style metadata lives in moov/udta/meta/ilst, often followed by a
+// free atom to grow into. when it does not fit and moov is at the end of
+// the file, which is where libavformat puts it, the rest of moov can move
+// without touching any chunk offsets.
+static int write_mp4(struct TagWriter *w) {
+    struct Mp4Atom moov, udta, meta, ilst;
+    if (find_mp4_atom(w->pb, 0, w->file_size, MKTAG('m','o','o','v'), &moov) < 0 ||
+        find_mp4_atom(w->pb, moov.offset + moov.header_size, moov.offset + moov.size,
+            MKTAG('u','d','t','a'), &udta) < 0 ||
+        find_mp4_atom(w->pb, udta.offset + udta.header_size, udta.offset + udta.size,
+            MKTAG('m','e','t','a'), &meta) < 0 ||
+        // meta has version and flags before its children
+        find_mp4_atom(w->pb, meta.offset + meta.header_size + 4, meta.offset + meta.size,
+            MKTAG('i','l','s','t'), &ilst) < 0)
+    {
+        return 0;
+    }
+    // the sizes we may have to change are all 32 bits
+    if (moov.header_size != 8 || udta.header_size != 8 || meta.header_size != 8 ||
+        ilst.header_size != 8)
+    {
+        return 0;
+    }
+
+    int64_t meta_end = meta.offset + meta.size;
+    int64_t region_end = ilst.offset + ilst.size;
+    struct Mp4Atom free_atom;
+    while (read_mp4_atom(w->pb, region_end, meta_end, &free_atom) >= 0 &&
+           (free_atom.type == MKTAG('f','r','e','e') || free_atom.type == MKTAG('s','k','i','p')))
+    {
+        region_end += free_atom.size;
+    }
+    int64_t region_size = region_end - ilst.offset;
+
+    uint8_t *body = read_at(w, ilst.offset + 8, ilst.size - 8);
+    if (!body)
+        return 0;
+    AVIOContext *out;
+    if (avio_open_dyn_buf(&out) < 0) {
+        av_free(body);
+        return -1;
+    }
+    avio_wb32(out, 0); // filled in below
+    avio_wl32(out, MKTAG('i','l','s','t'));
+    put_mp4_items(out, w->metadata);
+    int64_t body_size = ilst.size - 8;
+    int64_t pos = 0;
+    int err = 0;
+    while (pos + 8 <= body_size) {
+        int64_t size = AV_RB32(body + pos);
+        if (size < 8 || size > body_size - pos) {
+            err = -1;
+            break;
+        }
+        if (!is_mp4_metadata_item(AV_RL32(body + pos + 4)))
+            avio_write(out, body + pos, size);
+        pos += size;
+    }
+    av_free(body);
+
+    int64_t ilst_size = avio_tell(out);
+    int64_t room = region_size - ilst_size;
+    int in_place = (w->flags & GROOVE_TAGS_IN_PLACE) && (room == 0 || room >= 8);
+    int grow = (w->flags & GROOVE_TAGS_EXTEND) && moov.offset + moov.size == w->file_size;
+    int64_t padding = in_place ? room : (w->padding > 0 ? FFMAX(w->padding, 8) : 0);
+    // a free atom takes at least 8 bytes
+    if (!in_place && padding < room && (w->flags & GROOVE_TAGS_NO_SHRINK))
+        padding = FFMAX(room, 8);
+    int64_t delta = ilst_size + padding - region_size;
+    if (err < 0 || (!in_place && !grow) || moov.size + delta > UINT32_MAX) {
+        uint8_t *data;
+        avio_close_dyn_buf(out, &data);
+        av_free(data);
+        return 0;
+    }
+    if (padding > 0)
+        put_mp4_free(out, padding);
+    uint8_t *data;
+    int size = avio_close_dyn_buf(out, &data);
+    AV_WB32(data, ilst_size);
+
+    if (in_place) {
+        int ret = write_at(w, ilst.offset, data, size);
+        av_free(data);
+        return ret < 0 ? -1 : 1;
+    }
+
+    uint8_t *tail = read_at(w, region_end, w->file_size - region_end);
+    if (!tail) {
+        av_free(data);
+        return 0;
+    }
+    int fd = open(w->filename, O_WRONLY);
+    if (fd < 0) {
+        av_free(data);
+        av_free(tail);
+        av_log(NULL, AV_LOG_ERROR, "%s: unable to open for writing\n", w->filename);
+        return -1;
+    }
+    uint8_t sizes[3][4];
+    AV_WB32(sizes[0], moov.size + delta);
+    AV_WB32(sizes[1], udta.size + delta);
+    AV_WB32(sizes[2], meta.size + delta);
+    err = write_all(fd, ilst.offset, data, size);
+    if (err >= 0)
+        err = write_all(fd, ilst.offset + size, tail, w->file_size - region_end);
+    if (err >= 0 && delta < 0)
+        err = ftruncate(fd, w->file_size + delta);
+    if (err >= 0)
+        err = write_all(fd, meta.offset, sizes[2], 4);
+    if (err >= 0)
+        err = write_all(fd, udta.offset, sizes[1], 4);
+    if (err >= 0)
+        err = write_all(fd, moov.offset, sizes[0], 4);
+    if (close(fd) != 0)
+        err = -1;
+    av_free(data);
+    av_free(tail);
+    if (err < 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s: error writing tags\n", w->filename);
+        return -1;
+    }
+    return 1;
+}
+
+static int read_ogg_page(AVIOContext *pb, int64_t offset, struct OggPage *page) {
+    uint8_t header[OGG_PAGE_HEADER_SIZE];
+    if (avio_seek(pb, offset, SEEK_SET) < 0 || avio_read(pb, header, sizeof(header)) != sizeof(header) ||
+        memcmp(header, "OggS", 4) != 0 || header[4] != 0)
+    {
+        return -1;
+    }
+    page->flags = header[5];
+    page->serial = AV_RL32(header + 14);
+    page->sequence = AV_RL32(header + 18);
+    page->segment_count = header[26];
+    if (avio_read(pb, page->segments, page->segment_count) != page->segment_count)
+        return -1;
+    page->data_size = 0;
+    for (int i = 0; i < page->segment_count; i += 1)
+        page->data_size += page->segments[i];
+    page->size = OGG_PAGE_HEADER_SIZE + page->segment_count + page->data_size;
+    return 0;
+}
+
+static void set_ogg_checksum(uint8_t *page, int size) {
+    AV_WL32(page + 22, 0);
+    uint32_t crc = av_crc(av_crc_get_table(AV_CRC_32_IEEE), 0, page, size);
+    AV_WB32(page + 22, crc);
+}
+
+static int ogg_lacing_count(int64_t packet_size) {
+    return packet_size / 255 + 1;
+}
+
+// lays packets out over exactly page_count pages, which must be between
+// the number of lacing values divided by 255 and the number of lacing
+// values. pages only holding part of a packet get a granule position of
+// -1, the others 0 as befits header pages.
+static int put_ogg_pages(AVIOContext *out, const uint8_t *data, const int64_t *packet_sizes,
+        int packet_count, int page_count, uint32_t serial, uint32_t sequence)
+{
+    int lacing_count = 0;
+    for (int i = 0; i < packet_count; i += 1)
+        lacing_count += ogg_lacing_count(packet_sizes[i]);
+    if (page_count > lacing_count || page_count * OGG_MAX_SEGMENTS < lacing_count)
+        return -1;
+
+    uint8_t *page = av_malloc(OGG_MAX_PAGE_SIZE);
+    if (!page)
+        return -1;
+    int packet = 0;
+    int64_t packet_left = packet_sizes[0];
+    int continued = 0;
+    for (int i = 0; i < page_count; i += 1) {
+        // leave at least one lacing value for each page to come
+        int segment_count = FFMIN(OGG_MAX_SEGMENTS, lacing_count - (page_count - i - 1));
+        lacing_count -= segment_count;
+        int64_t granule = -1;
+        int data_size = 0;
+        for (int j = 0; j < segment_count; j += 1) {
+            int segment = FFMIN(packet_left, 255);
+            page[OGG_PAGE_HEADER_SIZE + j] = segment;
+            data_size += segment;
+            packet_left -= segment;
+            if (segment < 255) {
+                granule = 0;
+                packet += 1;
+                packet_left = packet < packet_count ? packet_sizes[packet] : 0;
+            }
+        }
+        memcpy(page, "OggS", 4);
+        page[4] = 0;
+        page[5] = continued ? OGG_FLAG_CONTINUED : 0;
+        AV_WL64(page + 6, granule);
+        AV_WL32(page + 14, serial);
+        AV_WL32(page + 18, sequence + i);
+        page[26] = segment_count;
+        memcpy(page + OGG_PAGE_HEADER_SIZE + segment_count, data, data_size);
+        data += data_size;
+        int size = OGG_PAGE_HEADER_SIZE + segment_count + data_size;
+        set_ogg_checksum(page, size);
+        avio_write(out, page, size);
+        continued = page[OGG_PAGE_HEADER_SIZE + segment_count - 1] == 255;
+    }
+    av_free(page);
+    return 0;
+}
+
+// copies the pages from offset on, renumbering them by delta. returns 0
+// when a page of another stream shows up, which would need renumbering
+// of its own.
+static int copy_ogg_pages(struct TagWriter *w, struct TempFile *tmp, int64_t offset,
+        uint32_t serial, int delta)
+{
+    if (!delta)
+        return temp_copy(tmp, w->pb, offset, w->file_size) < 0 ? -1 : 1;
+
+    uint8_t *page = av_malloc(OGG_MAX_PAGE_SIZE);
+    if (!page)
+        return -1;
+    struct OggPage info;
+    while (offset < w->file_size) {
+        if (read_ogg_page(w->pb, offset, &info) < 0 || info.serial != serial ||
+            avio_seek(w->pb, offset, SEEK_SET) < 0 || avio_read(w->pb, page, info.size) != info.size)
+        {
+            av_free(page);
+            return 0;
+        }
+        AV_WL32(page + 18, info.sequence + delta);
+        set_ogg_checksum(page, info.size);
+        if (temp_write(tmp, page, info.size) < 0) {
+            av_free(page);
+            return -1;
+        }
+        offset += info.size;
+    }
+    av_free(page);
+    return 1;
+}
+
+// the Vorbis comment is the second header packet of Vorbis and Opus
+// streams, sharing pages with the Vorbis setup header. the header pages
+// after the first are paginated anew. the comment packet takes padding at
+// its end, which lets the new pages fill the old ones exactly; otherwise
+// the rest of the stream has to be renumbered.
+static int write_ogg(struct TagWriter *w) {
+    struct OggPage page;
+    if (read_ogg_page(w->pb, 0, &page) < 0 || !(page.flags & OGG_FLAG_BOS) ||
+        page.segment_count != 1 || page.data_size < 8)
+    {
+        return 0;
+    }
+    uint8_t ident[8];
+    if (avio_read(w->pb, ident, sizeof(ident)) != sizeof(ident))
+        return 0;
+    const char *magic;
+    int magic_len, header_count, framing_bit;
+    if (!memcmp(ident, "\x01vorbis", 7)) {
+        magic = "\x03vorbis";
+        magic_len = 7;
+        header_count = 3;
+        framing_bit = 1;
+    } else if (!memcmp(ident, "OpusHead", 8)) {
+        magic = "OpusTags";
+        magic_len = 8;
+        header_count = 2;
+        framing_bit = 0;
+    } else {
+        return 0;
+    }
+    uint32_t serial = page.serial;
+    uint32_t sequence = page.sequence + 1;
+
+    // gather the header packets after the first, up to the end of a page
+    int64_t region_start = page.size;
+    int64_t region_end = region_start;
+    int page_count = 0;
+    int64_t packet_sizes[3];
+    int packet_count = 0;
+    int64_t packet_size = 0;
+    AVIOContext *headers;
+    if (avio_open_dyn_buf(&headers) < 0)
+        return -1;
+    int err = 0;
+    for (;;) {
+        if (read_ogg_page(w->pb, region_end, &page) < 0 || page.serial != serial ||
+            page.sequence != sequence + page_count || region_end - region_start > MAX_TAG_SIZE)
+        {
+            err = -1;
+            break;
+        }
+        uint8_t *data = read_at(w, region_end + page.size - page.data_size, page.data_size);
+        if (!data) {
+            err = -1;
+            break;
+        }
+        avio_write(headers, data, page.data_size);
+        av_free(data);
+        for (int i = 0; i < page.segment_count && err >= 0; i += 1) {
+            packet_size += page.segments[i];
+            if (page.segments[i] < 255) {
+                if (packet_count == header_count - 1)
+                    err = -1;
+                else
+                    packet_sizes[packet_count++] = packet_size;
+                packet_size = 0;
+            }
+        }
+        region_end += page.size;
+        page_count += 1;
+        if (err < 0 || (packet_count == header_count - 1 && packet_size == 0))
+            break;
+    }
+    uint8_t *header_data;
+    int header_size = avio_close_dyn_buf(headers, &header_data);
+    if (err < 0 || packet_sizes[0] < magic_len || memcmp(header_data, magic, magic_len) != 0) {
+        av_free(header_data);
+        return 0;
+    }
+
+    int vendor_len = 0;
+    const uint8_t *vendor = vorbis_comment_vendor(header_data + magic_len,
+            packet_sizes[0] - magic_len, &vendor_len);
+    AVIOContext *comment;
+    if (avio_open_dyn_buf(&comment) < 0) {
+        av_free(header_data);
+        return -1;
+    }
+    avio_write(comment, (const uint8_t *) magic, magic_len);
+    put_vorbis_comment(comment, vendor, vendor_len, w->metadata);
+    if (framing_bit)
+        avio_w8(comment, 1);
+    int64_t comment_size = avio_tell(comment);
+    int64_t others_size = header_size - packet_sizes[0];
+    int others_lacing_count = 0;
+    for (int i = 1; i < packet_count; i += 1)
+        others_lacing_count += ogg_lacing_count(packet_sizes[i]);
+
+    // look for padding that makes the pages come out at the old size
+    int64_t region_size = region_end - region_start;
+    int64_t padding = -1;
+    int new_page_count = page_count;
+    if (w->flags & GROOVE_TAGS_IN_PLACE) {
+        for (int64_t pad = 0;; pad += 1) {
+            int lacing_count = ogg_lacing_count(comment_size + pad) + others_lacing_count;
+            int64_t size = OGG_PAGE_HEADER_SIZE * page_count + lacing_count +
+                comment_size + pad + others_size;
+            if (size > region_size)
+                break;
+            if (size == region_size && lacing_count >= page_count &&
+                lacing_count <= page_count * OGG_MAX_SEGMENTS)
+            {
+                padding = pad;
+                break;
+            }
+        }
+    }
+    int in_place = padding >= 0;
+    if (!in_place && (w->flags & GROOVE_TAGS_REWRITE)) {
+        padding = w->padding;
+        int lacing_count = ogg_lacing_count(comment_size + padding) + others_lacing_count;
+        new_page_count = (lacing_count + OGG_MAX_SEGMENTS - 1) / OGG_MAX_SEGMENTS;
+    }
+    if (padding < 0) {
+        uint8_t *data;
+        avio_close_dyn_buf(comment, &data);
+        av_free(data);
+        av_free(header_data);
+        return 0;
+    }
+    put_zeros(comment, padding);
+    avio_write(comment, header_data + packet_sizes[0], others_size);
+    packet_sizes[0] = comment_size + padding;
+    av_free(header_data);
+    uint8_t *packets;
+    avio_close_dyn_buf(comment, &packets);
+
+    AVIOContext *out;
+    if (avio_open_dyn_buf(&out) < 0) {
+        av_free(packets);
+        return -1;
+    }
+    err = put_ogg_pages(out, packets, packet_sizes, packet_count, new_page_count, serial, sequence);
+    av_free(packets);
+    uint8_t *data;
+    int size = avio_close_dyn_buf(out, &data);
+    if (err < 0) {
+        av_free(data);
+        return 0;
+    }
+
+    int ret;
+    if (in_place) {
+        ret = write_at(w, region_start, data, size) < 0 ? -1 : 1;
+    } else {
+        struct TempFile tmp;
+        if (temp_open(&tmp, w->filename) < 0) {
+            av_free(data);
+            return -1;
+        }
+        ret = temp_copy(&tmp, w->pb, 0, region_start) < 0 || temp_write(&tmp, data, size) < 0 ? -1 :
+            copy_ogg_pages(w, &tmp, region_end, serial, new_page_count - page_count);
+        if (ret > 0)
+            ret = temp_commit(&tmp, w->filename) < 0 ? -1 : 1;
+        else
+            temp_discard(&tmp);
+    }
+    av_free(data);
+    return ret;
+}
+
+int groove_tags_write(const char *filename, const char *format_name,
+        AVDictionary *metadata, int padding, int flags)
+{
+    int (*write_tags)(struct TagWriter *w);
+    if (!strcmp(format_name, "flac"))
+        write_tags = write_flac;
+    else if (!strcmp(format_name, "mp3"))
+        write_tags = write_id3v2;
+    else if (!strcmp(format_name, "ogg"))
+        write_tags = write_ogg;
+    else if (strstr(format_name, "mp4"))
+        write_tags = write_mp4;
+    else
+        return 0;
+
+    struct TagWriter w = {
+        .filename = filename,
+        .metadata = metadata,
+        .padding = FFMAX(padding, 0),
+        .flags = flags,
+    };
+    if (avio_open(&w.pb, filename, AVIO_FLAG_READ) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "could not open '%s'\n", filename);
+        return -1;
+    }
+    w.file_size = avio_size(w.pb);
+    int ret = w.file_size > 0 ? write_tags(&w) : 0;
+    avio_close(w.pb);
+    return ret;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_TAGS_H_INCLUDED
+#define GROOVE_TAGS_H_INCLUDED
+
+#include <libavutil/dict.h>
+
+// only write the tags if they fit in the space of the old ones, including
+// padding left for the purpose
+#define GROOVE_TAGS_IN_PLACE 1
+// otherwise rewrite the tags with padding bytes of room to grow, moving
+// what follows them. EXTEND allows it when only the end of the file has to
+// move, which is the case for mp4 files with the moov atom last. REWRITE
+// allows copying the whole file, which is still cheaper than a remux as
+// nothing is demuxed.
+#define GROOVE_TAGS_EXTEND 2
+#define GROOVE_TAGS_REWRITE 4
+// with EXTEND, never make the file shorter. a memory map of the file would
+// fault on reads past the new end.
+#define GROOVE_TAGS_NO_SHRINK 8
+
+// writes metadata into the tags of filename directly, for ID3v2 in mp3,
+// Vorbis comments in flac and in Ogg Vorbis and Opus, and the ilst atom
+// of mp4. format_name is the demuxer's name for the file. metadata uses
+// the same names as the demuxer and is converted the way libavformat's
+// muxers would.
+// returns 1 when the tags were written, 0 when the format or the layout
+// of the file is not handled or flags rule it out, in which case the file
+// is unchanged and the caller should remux, < 0 on error.
+int groove_tags_write(const char *filename, const char *format_name,
+        AVDictionary *metadata, int padding, int flags);
+
+#endif /* GROOVE_TAGS_H_INCLUDED */
@@ -18,6 +18,23 @@
 #include <string.h>
 #include <pthread.h>
 
+// one playlist item in a parallel scan
+struct ScanSlot {
+    struct GroovePlaylistItem *item;
+    double pos; // position of the worker scanning this item
+    double duration;
+    int done;
+};
+
+// each worker decodes one item at a time through its own playlist
+struct ScanWorker {
+    struct GrooveLoudnessDetectorPrivate *d;
+    struct GroovePlaylist *playlist;
+    struct GrooveSink *sink;
+    pthread_t thread_id;
+    char thread_inited;
+};
+
 struct GrooveLoudnessDetectorPrivate {
     struct GrooveLoudnessDetector externals;
 
@@ -47,19 +64,30 @@ struct GrooveLoudnessDetectorPrivate {
     // set temporarily
     struct GroovePlaylistItem *purge_item;
 
+    // parallel scan state, also protected by info_head_mutex.
+    // slots are indexed the same as all_track_states
+    struct ScanSlot *slots;
+    int slot_count;
+    int next_slot; // next slot for a worker to pick up
+    int emit_slot; // next slot to put in the info queue
+    int sent_album;
+    struct ScanWorker *workers;
+    int worker_count;
+
     int abort_request;
 };
 
-static int emit_track_info(struct GrooveLoudnessDetectorPrivate *d) {
+static int put_track_info(struct GrooveLoudnessDetectorPrivate *d,
+        struct GroovePlaylistItem *item, ebur128_state *cur_track_state, double duration)
+{
     struct GrooveLoudnessDetectorInfo *info = av_mallocz(sizeof(struct GrooveLoudnessDetectorInfo));
     if (!info) {
         av_log(NULL, AV_LOG_ERROR, "unable to allocate loudness detector info\n");
         return -1;
     }
-    info->item = d->info_head;
-    info->duration = d->track_duration;
+    info->item = item;
+    info->duration = duration;
 
-    ebur128_state *cur_track_state = d->all_track_states[d->cur_track_index];
     ebur128_loudness_global(cur_track_state, &info->loudness);
     ebur128_sample_peak(cur_track_state, 0, &info->peak);
     double out;
@@ -72,6 +100,11 @@ static int emit_track_info(struct GrooveLoudnessDetectorPrivate *d) {
     return 0;
 }
 
+static int emit_track_info(struct GrooveLoudnessDetectorPrivate *d) {
+    return put_track_info(d, d->info_head, d->all_track_states[d->cur_track_index],
+            d->track_duration);
+}
+
 static int resize_state_history(struct GrooveLoudnessDetectorPrivate *d) {
     int new_size = d->state_history_count * 2;
     d->all_track_states = realloc(d->all_track_states, new_size);
@@ -187,6 +220,244 @@ static void *detect_thread(void *arg) {
     return NULL;
 }
 
+// put every finished slot that is next in playlist order into the info
+// queue, and the album info after the last one. call with info_head_mutex
+// held.
+static void emit_ready_slots(struct GrooveLoudnessDetectorPrivate *d) {
+    struct GrooveLoudnessDetector *detector = &d->externals;
+
+    while (d->emit_slot < d->slot_count && d->slots[d->emit_slot].done) {
+        struct ScanSlot *slot = &d->slots[d->emit_slot];
+        ebur128_state **state = &d->all_track_states[d->emit_slot];
+        if (*state) {
+            put_track_info(d, slot->item, *state, slot->duration);
+            if (detector->disable_album)
+                ebur128_destroy(state);
+        }
+        d->album_duration += slot->duration;
+        d->emit_slot += 1;
+    }
+
+    if (d->emit_slot == d->slot_count) {
+        d->info_head = NULL;
+        d->info_pos = -1.0;
+    } else {
+        d->info_head = d->slots[d->emit_slot].item;
+        d->info_pos = d->slots[d->emit_slot].pos;
+    }
+
+    if (d->emit_slot < d->slot_count || d->sent_album)
+        return;
+    d->sent_album = 1;
+
+    struct GrooveLoudnessDetectorInfo *info = av_mallocz(
+            sizeof(struct GrooveLoudnessDetectorInfo));
+    if (!info) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate album loudness info\n");
+        return;
+    }
+    info->duration = d->album_duration;
+    if (!detector->disable_album) {
+        // tracks which failed to allocate a state are left out
+        int count = 0;
+        for (int i = 0; i < d->slot_count; i += 1) {
+            if (d->all_track_states[i])
+                d->all_track_states[count++] = d->all_track_states[i];
+        }
+        for (int i = count; i < d->slot_count; i += 1)
+            d->all_track_states[i] = NULL;
+        if (count > 0)
+            ebur128_loudness_global_multiple(d->all_track_states, count, &info->loudness);
+    }
+    info->peak = d->album_peak;
+    groove_queue_put(d->info_queue, info);
+}
+
+// whether a worker is decoding file right now. call with info_head_mutex held.
+static int file_is_scanning(struct GrooveLoudnessDetectorPrivate *d, struct GrooveFile *file) {
+    for (int i = d->emit_slot; i < d->next_slot; i += 1) {
+        if (!d->slots[i].done && d->slots[i].item->file == file)
+            return 1;
+    }
+    return 0;
+}
+
+static void scan_slot(struct ScanWorker *w, int index) {
+    struct GrooveLoudnessDetectorPrivate *d = w->d;
+    struct ScanSlot *slot = &d->slots[index];
+
+    ebur128_state *state = ebur128_init(2, 44100, EBUR128_MODE_SAMPLE_PEAK|EBUR128_MODE_I);
+    if (!state)
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate EBU R128 track context\n");
+
+    double duration = 0.0;
+    // without an item the sink would never see GROOVE_BUFFER_END. the slot
+    // is finished with no track state, like one whose state failed to
+    // allocate, so that the emitter moves past it.
+    if (!groove_playlist_insert(w->playlist, slot->item->file, slot->item->gain, NULL)) {
+        av_log(NULL, AV_LOG_ERROR, "unable to scan item: out of memory\n");
+        if (state)
+            ebur128_destroy(&state);
+        pthread_mutex_lock(&d->info_head_mutex);
+        d->all_track_states[index] = NULL;
+        slot->duration = duration;
+        slot->done = 1;
+        pthread_mutex_unlock(&d->info_head_mutex);
+        return;
+    }
+
+    struct GrooveBuffer *buffer;
+    // the sink sees GROOVE_BUFFER_END once the only item is decoded
+    while (groove_sink_buffer_get(w->sink, &buffer, 1) == GROOVE_BUFFER_YES) {
+        duration += buffer->frame_count / (double)buffer->format.sample_rate;
+        if (state) {
+            ebur128_add_frames_double(state, (double*)buffer->data[0],
+                    buffer->frame_count);
+        }
+        pthread_mutex_lock(&d->info_head_mutex);
+        slot->pos = buffer->pos;
+        pthread_mutex_unlock(&d->info_head_mutex);
+        groove_buffer_unref(buffer);
+    }
+
+    groove_playlist_clear(w->playlist);
+
+    pthread_mutex_lock(&d->info_head_mutex);
+    d->all_track_states[index] = state;
+    slot->duration = duration;
+    slot->done = 1;
+    pthread_mutex_unlock(&d->info_head_mutex);
+}
+
+static void *scan_thread(void *arg) {
+    struct ScanWorker *w = arg;
+    struct GrooveLoudnessDetectorPrivate *d = w->d;
+    struct GrooveLoudnessDetector *detector = &d->externals;
+
+    pthread_mutex_lock(&d->info_head_mutex);
+    while (!d->abort_request && d->next_slot < d->slot_count) {
+        // two workers must not decode the same file at once
+        if (d->info_queue_count >= detector->info_queue_size ||
+            file_is_scanning(d, d->slots[d->next_slot].item->file))
+        {
+            pthread_cond_wait(&d->drain_cond, &d->info_head_mutex);
+            continue;
+        }
+        int index = d->next_slot;
+        d->next_slot += 1;
+        pthread_mutex_unlock(&d->info_head_mutex);
+
+        scan_slot(w, index);
+
+        pthread_mutex_lock(&d->info_head_mutex);
+        if (!d->abort_request)
+            emit_ready_slots(d);
+        pthread_cond_broadcast(&d->drain_cond);
+    }
+    pthread_mutex_unlock(&d->info_head_mutex);
+
+    return NULL;
+}
+
+static int attach_workers(struct GrooveLoudnessDetectorPrivate *d) {
+    struct GrooveLoudnessDetector *detector = &d->externals;
+    struct GroovePlaylist *playlist = detector->playlist;
+
+    d->slot_count = groove_playlist_count(playlist);
+    d->slots = av_mallocz((d->slot_count + 1) * sizeof(struct ScanSlot));
+    d->state_history_count = d->slot_count + 1;
+    d->all_track_states = calloc(d->state_history_count, sizeof(ebur128_state*));
+    if (!d->slots || !d->all_track_states) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate loudness scan slots\n");
+        return -1;
+    }
+    // so that detach cleans up every track state
+    d->cur_track_index = d->slot_count;
+
+    struct GroovePlaylistItem *item = playlist->head;
+    for (int i = 0; i < d->slot_count; i += 1) {
+        d->slots[i].item = item;
+        d->slots[i].pos = -1.0;
+        item = item->next;
+    }
+    d->next_slot = 0;
+    d->emit_slot = 0;
+    d->sent_album = 0;
+    d->album_peak = 0.0;
+    d->album_duration = 0.0;
+
+    d->worker_count = detector->worker_count;
+    if (d->worker_count > d->slot_count)
+        d->worker_count = d->slot_count > 0 ? d->slot_count : 1;
+    d->workers = av_mallocz(d->worker_count * sizeof(struct ScanWorker));
+    if (!d->workers) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate loudness scan workers\n");
+        return -1;
+    }
+
+    for (int i = 0; i < d->worker_count; i += 1) {
+        struct ScanWorker *w = &d->workers[i];
+        w->d = d;
+        w->playlist = groove_playlist_create();
+        w->sink = groove_sink_create();
+        if (!w->playlist || !w->sink) {
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate loudness scan worker\n");
+            return -1;
+        }
+        groove_playlist_set_volume(w->playlist, playlist->volume);
+        w->sink->audio_format = d->sink->audio_format;
+        w->sink->buffer_size = detector->sink_buffer_size;
+        if (groove_sink_attach(w->sink, w->playlist) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "unable to attach sink\n");
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < d->worker_count; i += 1) {
+        struct ScanWorker *w = &d->workers[i];
+        if (pthread_create(&w->thread_id, NULL, scan_thread, w) != 0) {
+            av_log(NULL, AV_LOG_ERROR, "unable to create loudness scan thread\n");
+            return -1;
+        }
+        w->thread_inited = 1;
+    }
+
+    // an empty playlist still gets its album info
+    pthread_mutex_lock(&d->info_head_mutex);
+    emit_ready_slots(d);
+    pthread_mutex_unlock(&d->info_head_mutex);
+
+    return 0;
+}
+
+static void detach_workers(struct GrooveLoudnessDetectorPrivate *d) {
+    for (int i = 0; i < d->worker_count; i += 1) {
+        struct ScanWorker *w = &d->workers[i];
+        if (w->sink)
+            groove_sink_detach(w->sink);
+    }
+
+    pthread_mutex_lock(&d->info_head_mutex);
+    pthread_cond_broadcast(&d->drain_cond);
+    pthread_mutex_unlock(&d->info_head_mutex);
+
+    for (int i = 0; i < d->worker_count; i += 1) {
+        struct ScanWorker *w = &d->workers[i];
+        if (w->thread_inited)
+            pthread_join(w->thread_id, NULL);
+        if (w->playlist)
+            groove_playlist_destroy(w->playlist);
+        groove_sink_destroy(w->sink);
+    }
+
+    av_free(d->workers);
+    d->workers = NULL;
+    d->worker_count = 0;
+    av_free(d->slots);
+    d->slots = NULL;
+    d->slot_count = 0;
+}
+
 static void info_queue_cleanup(struct GrooveQueue* queue, void *obj) {
     struct GrooveLoudnessDetectorInfo *info = obj;
     struct GrooveLoudnessDetectorPrivate *d = queue->context;
@@ -205,8 +476,9 @@ static void info_queue_get(struct GrooveQueue *queue, void *obj) {
 
     d->info_queue_count -= 1;
 
+    // parallel scan workers may all be waiting
     if (d->info_queue_count < detector->info_queue_size)
-        pthread_cond_signal(&d->drain_cond);
+        pthread_cond_broadcast(&d->drain_cond);
 }
 
 static int info_queue_purge(struct GrooveQueue* queue, void *obj) {
@@ -301,6 +573,7 @@ struct GrooveLoudnessDetector *groove_loudness_detector_create(void) {
     // set some defaults
     detector->info_queue_size = INT_MAX;
     detector->sink_buffer_size = d->sink->buffer_size;
+    detector->worker_count = 1;
 
     return detector;
 }
@@ -334,6 +607,14 @@ int groove_loudness_detector_attach(struct GrooveLoudnessDetector *detector,
     detector->playlist = playlist;
     groove_queue_reset(d->info_queue);
 
+    if (detector->worker_count > 1) {
+        if (attach_workers(d) < 0) {
+            groove_loudness_detector_detach(detector);
+            return -1;
+        }
+        return 0;
+    }
+
     // set the initial state history size. if we run out we will realloc later.
     d->state_history_count = detector->disable_album ? 1 : 128;
     d->all_track_states = calloc(d->state_history_count, sizeof(ebur128_state*));
@@ -363,11 +644,17 @@ int groove_loudness_detector_detach(struct GrooveLoudnessDetector *detector) {
     struct GrooveLoudnessDetectorPrivate *d = (struct GrooveLoudnessDetectorPrivate *) detector;
 
     d->abort_request = 1;
-    groove_sink_detach(d->sink);
-    groove_queue_flush(d->info_queue);
-    groove_queue_abort(d->info_queue);
-    pthread_cond_signal(&d->drain_cond);
-    pthread_join(d->thread_id, NULL);
+    if (d->workers) {
+        detach_workers(d);
+        groove_queue_flush(d->info_queue);
+        groove_queue_abort(d->info_queue);
+    } else {
+        groove_sink_detach(d->sink);
+        groove_queue_flush(d->info_queue);
+        groove_queue_abort(d->info_queue);
+        pthread_cond_signal(&d->drain_cond);
+        pthread_join(d->thread_id, NULL);
+    }
 
     detector->playlist = NULL;
 
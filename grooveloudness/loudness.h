@@ -60,6 +60,17 @@ struct GrooveLoudnessDetector {
 
     /* read-only. set when attached and cleared when detached */
     struct GroovePlaylist *playlist;
+
+    /* set to more than 1 to analyze that many playlist items at once, each
+     * one decoded on its own thread. the items in the playlist at attach
+     * time are scanned once; their info still comes out in playlist order,
+     * followed by the album info.
+     * in this mode the detector decodes the files itself instead of
+     * consuming the playlist, so attach no other sinks to the playlist and
+     * leave it and its files alone until the album info arrives.
+     * groove_loudness_detector_create defaults this to 1
+     */
+    int worker_count;
 };
 
 struct GrooveLoudnessDetector *groove_loudness_detector_create(void);
@@ -13,28 +13,307 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_audio.h>
 #include <pthread.h>
+#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// capacity of each ring between the audio callback and feed_thread. must be
+// a power of 2
+#define PLAYER_RING_SIZE 64
+// feed_thread keeps this many device buffers worth of audio ready for the
+// audio callback
+#define FEED_DEVICE_BUFFERS 4
+// how long feed_thread waits for the audio callback before it looks at the
+// sink again, in milliseconds
+#define FEED_POLL_MS 5
+// how many changes of the play head the clock remembers. only those that
+// are still in the device buffer are needed.
+#define PLAYER_CLOCK_SEGMENTS 16
+// positions closer than this, in seconds, count as continuous
+#define PLAYER_CLOCK_EPSILON 0.0005
+// monotonic_time counts this many per second
+#define MONOTONIC_TIME_FREQUENCY 1000000000
+
+// single producer, single consumer ring of pointers. neither side locks or
+// allocates, so the audio callback can use it.
+struct PlayerRing {
+    void *items[PLAYER_RING_SIZE];
+    atomic_size_t head;
+    atomic_size_t tail;
+};
+
+// from device time at on, the device plays item starting pos seconds in,
+// or silence if playing is 0. device time counts the seconds of audio the
+// audio callback has written since the device was opened.
+struct PlayerSegment {
+    struct GroovePlaylistItem *item;
+    double pos;
+    double at;
+    int playing;
+};
+
+// the audio callback's running totals for groove_player_stats
+struct PlayerStats {
+    int callback_count;
+    int underrun_count;
+    double max_jitter;
+    double total_jitter;
+    double max_callback_duration;
+    double total_callback_duration;
+};
+
+// what the speakers play: at output time stamp they are at device
+// time base, and from there they move in real time up to limit, which is
+// where the audio callback expects them to be at its next call
+struct PlayerClock {
+    // in order of at. the first one began at or before base
+    struct PlayerSegment segments[PLAYER_CLOCK_SEGMENTS];
+    int segment_count;
+    double base;
+    double limit;
+    Uint64 stamp;
+};
 
 struct GroovePlayerPrivate {
     struct GroovePlayer externals;
+
+    // only touched by the audio callback, or with the device locked
     struct GrooveBuffer *audio_buf;
     size_t audio_buf_size; // in bytes
     size_t audio_buf_index; // in bytes
 
-    // this mutex applies to the variables in this block
-    pthread_mutex_t play_head_mutex;
-    char play_head_mutex_inited;
-    // pointer to current item where the buffered audio is reaching the device
+    // the item and position of the audio the callback is writing, and the
+    // device time it has written up to. only touched by the audio callback,
+    // or with the device locked
     struct GroovePlaylistItem *play_head;
-    // number of seconds into the play_head song where the buffered audio
-    // is reaching the device
     double play_pos;
-
+    double device_time;
+    struct PlayerClock clock;
+
+    struct PlayerStats stats;
+
+    // the audio callback copies clock and stats here with clock_seq odd
+    // while it is writing, for groove_player_position and
+    // groove_player_stats to read
+    atomic_uint clock_seq;
+    struct PlayerClock published_clock;
+    struct PlayerStats published_stats;
+
+    // seconds of audio between the audio callback and the speakers: the
+    // device buffer that is playing while the callback fills the next one
+    double latency;
+
+    // the item groove_player_position last gave when feed_thread looked,
+    // to emit GROOVE_EVENT_NOWPLAYING when the speakers move on. protected
+    // by feed_mutex
+    struct GroovePlaylistItem *heard_item;
+
+    // feed_thread takes buffers out of the sink and puts them in
+    // buffer_ring for the audio callback, which hands them back through
+    // release_ring once it is done with them and reports events through
+    // event_ring. that way the audio callback never locks or allocates.
+    struct PlayerRing buffer_ring;
+    struct PlayerRing release_ring;
+    struct PlayerRing event_ring;
+    // bytes of audio in buffer_ring
+    atomic_int ring_bytes;
+    // how many bytes feed_thread keeps in buffer_ring
+    int feed_bytes;
+
+    pthread_t feed_thread_id;
+    char feed_thread_inited;
+    // keeps sink_flush and sink_purge from running while feed_thread fills
+    // buffer_ring. feed_abort is protected by it
+    pthread_mutex_t feed_mutex;
+    char feed_mutex_inited;
+    int feed_abort;
+    // the audio callback posts this to wake up feed_thread
+    SDL_sem *feed_sem;
+
+    // output is copied from the player on attach. GROOVE_PLAYER_OUTPUT_DEVICE
+    // uses device_id, the others output_thread
+    enum GroovePlayerOutput output;
+    char sdl_audio_inited;
     SDL_AudioDeviceID device_id;
+
+    // output_thread runs the audio callback on a timer, output_speed times
+    // as fast as the device would, counting from output_start. it holds
+    // output_mutex meanwhile, the way SDL holds the lock of a device.
+    // output_abort is protected by output_mutex
+    pthread_t output_thread_id;
+    char output_thread_inited;
+    pthread_mutex_t output_mutex;
+    char output_mutex_inited;
+    int output_abort;
+    double output_speed;
+    Uint64 output_start;
+    Uint8 *output_buf;
+    int output_buf_size;
+    FILE *output_file;
+
     struct GrooveSink *sink;
 
     struct GrooveQueue *eventq;
 };
 
+// stands in for the end of the playlist in buffer_ring
+static char end_of_playlist;
+
+static int ring_push(struct PlayerRing *ring, void *item) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head >= PLAYER_RING_SIZE)
+        return 0;
+    ring->items[tail & (PLAYER_RING_SIZE - 1)] = item;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+static int ring_pop(struct PlayerRing *ring, void **item) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail)
+        return 0;
+    *item = ring->items[head & (PLAYER_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+static int ring_count(struct PlayerRing *ring) {
+    return atomic_load(&ring->tail) - atomic_load(&ring->head);
+}
+
+static void ring_init(struct PlayerRing *ring) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+// only the audio callback calls this, or another thread with the device
+// locked
+static void publish_clock(struct GroovePlayerPrivate *p) {
+    unsigned seq = atomic_load_explicit(&p->clock_seq, memory_order_relaxed);
+    atomic_store_explicit(&p->clock_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    p->published_clock = p->clock;
+    p->published_stats = p->stats;
+    atomic_store_explicit(&p->clock_seq, seq + 2, memory_order_release);
+}
+
+// you may pass NULL for clock or stats
+static void read_published(struct GroovePlayerPrivate *p, struct PlayerClock *clock,
+        struct PlayerStats *stats)
+{
+    unsigned seq;
+    do {
+        seq = atomic_load_explicit(&p->clock_seq, memory_order_acquire);
+        if (clock)
+            *clock = p->published_clock;
+        if (stats)
+            *stats = p->published_stats;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&p->clock_seq, memory_order_relaxed));
+}
+
+// the bundled SDL is built without timers, so SDL_GetPerformanceCounter
+// is of no use
+static Uint64 monotonic_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64) ts.tv_sec * MONOTONIC_TIME_FREQUENCY + ts.tv_nsec;
+}
+
+// the time the clock goes by, from monotonic_time. the null and file
+// outputs make it pass output_speed times as fast.
+static Uint64 output_time(struct GroovePlayerPrivate *p, Uint64 now) {
+    if (p->output == GROOVE_PLAYER_OUTPUT_DEVICE)
+        return now;
+    return p->output_start + (Uint64)((now - p->output_start) * p->output_speed);
+}
+
+// device time the speakers are at, never going past limit
+static double clock_device_time(struct GroovePlayerPrivate *p, struct PlayerClock *clock,
+        Uint64 now)
+{
+    double device_time = clock->base + (now - clock->stamp) / (double) MONOTONIC_TIME_FREQUENCY;
+    return device_time < clock->limit ? device_time : clock->limit;
+}
+
+static void clock_position(struct GroovePlayerPrivate *p, struct PlayerClock *clock,
+        struct GroovePlaylistItem **item, double *pos)
+{
+    if (clock->segment_count == 0) {
+        *item = NULL;
+        *pos = -1.0;
+        return;
+    }
+    double device_time = clock_device_time(p, clock, output_time(p, monotonic_time()));
+    int i = clock->segment_count - 1;
+    while (i > 0 && clock->segments[i].at > device_time)
+        i -= 1;
+    struct PlayerSegment *segment = &clock->segments[i];
+    *item = segment->item;
+    *pos = segment->pos;
+    if (segment->item && segment->playing && device_time > segment->at)
+        *pos += device_time - segment->at;
+}
+
+// the audio callback calls this before it writes anything. the speakers
+// are now a device buffer behind what it has written so far, or where they
+// were headed at the last call if that is further, so they never go back.
+static void clock_start(struct GroovePlayerPrivate *p, Uint64 now) {
+    struct PlayerClock *clock = &p->clock;
+    double base = p->device_time - p->latency;
+    if (clock->stamp) {
+        double last = clock_device_time(p, clock, now);
+        if (last > base)
+            base = last;
+    }
+    clock->base = base;
+    clock->stamp = now;
+
+    // forget what the speakers are past
+    int first = 0;
+    while (first + 1 < clock->segment_count && clock->segments[first + 1].at <= base)
+        first += 1;
+    if (first > 0) {
+        clock->segment_count -= first;
+        memmove(clock->segments, clock->segments + first,
+                clock->segment_count * sizeof(struct PlayerSegment));
+    }
+}
+
+// the audio callback calls this before it writes audio of play_head, or
+// silence if playing is 0
+static void clock_mark(struct GroovePlayerPrivate *p, int playing) {
+    struct PlayerClock *clock = &p->clock;
+    if (clock->segment_count > 0) {
+        struct PlayerSegment *last = &clock->segments[clock->segment_count - 1];
+        double pos = last->pos;
+        if (last->playing)
+            pos += p->device_time - last->at;
+        if (last->item == p->play_head && last->playing == playing &&
+            fabs(pos - p->play_pos) < PLAYER_CLOCK_EPSILON)
+        {
+            return;
+        }
+    }
+    if (clock->segment_count == PLAYER_CLOCK_SEGMENTS) {
+        clock->segment_count -= 1;
+        memmove(clock->segments, clock->segments + 1,
+                clock->segment_count * sizeof(struct PlayerSegment));
+    }
+    struct PlayerSegment *segment = &clock->segments[clock->segment_count];
+    segment->item = p->play_head;
+    segment->pos = p->play_pos;
+    segment->at = p->device_time;
+    segment->playing = playing;
+    clock->segment_count += 1;
+}
+
 static Uint16 groove_fmt_to_sdl_fmt(enum GrooveSampleFormat fmt) {
     switch (fmt) {
         case GROOVE_SAMPLE_FMT_U8:
@@ -79,6 +358,13 @@ static void emit_event(struct GrooveQueue *queue, enum GroovePlayerEventType typ
 }
 
 
+// report an event from the audio callback. feed_thread passes it on. if the
+// ring is full the event is dropped rather than waited for
+static void post_event(struct GroovePlayerPrivate *p, enum GroovePlayerEventType type) {
+    ring_push(&p->event_ring, (void *)(intptr_t)type);
+}
+
+// runs on the real-time audio thread, so it must not lock or allocate
 static void sdl_audio_callback(void *opaque, Uint8 *stream, int len) {
     struct GroovePlayerPrivate *p = opaque;
 
@@ -88,37 +374,53 @@ static void sdl_audio_callback(void *opaque, Uint8 *stream, int len) {
     double bytes_per_sec = sink->bytes_per_sec;
     int paused = !groove_playlist_playing(playlist);
 
-    pthread_mutex_lock(&p->play_head_mutex);
+    Uint64 begin = monotonic_time();
+    Uint64 now = output_time(p, begin);
+    struct PlayerStats *stats = &p->stats;
+    if (stats->callback_count > 0) {
+        // the device wants len bytes every len bytes worth of time
+        double interval = (now - p->clock.stamp) / (double) MONOTONIC_TIME_FREQUENCY;
+        double jitter = fabs(interval - len / bytes_per_sec);
+        stats->total_jitter += jitter;
+        if (jitter > stats->max_jitter)
+            stats->max_jitter = jitter;
+    }
+    stats->callback_count += 1;
+
+    clock_start(p, now);
 
     while (len > 0) {
         if (!paused && p->audio_buf_index >= p->audio_buf_size) {
-            groove_buffer_unref(p->audio_buf);
+            // feed_thread makes sure there is always room for this
+            if (p->audio_buf)
+                ring_push(&p->release_ring, p->audio_buf);
+            p->audio_buf = NULL;
             p->audio_buf_index = 0;
             p->audio_buf_size = 0;
 
-            int ret = groove_sink_buffer_get(p->sink, &p->audio_buf, 0);
-            if (ret == GROOVE_BUFFER_END) {
-                emit_event(p->eventq, GROOVE_EVENT_NOWPLAYING);
-
+            void *item;
+            if (!ring_pop(&p->buffer_ring, &item)) {
+                stats->underrun_count += 1;
+                post_event(p, GROOVE_EVENT_BUFFERUNDERRUN);
+            } else if (item == &end_of_playlist) {
                 p->play_head = NULL;
                 p->play_pos = -1.0;
-            } else if (ret == GROOVE_BUFFER_YES) {
-                if (p->play_head != p->audio_buf->item)
-                    emit_event(p->eventq, GROOVE_EVENT_NOWPLAYING);
-
+            } else {
+                p->audio_buf = item;
+                atomic_fetch_sub(&p->ring_bytes, p->audio_buf->size);
                 p->play_head = p->audio_buf->item;
                 p->play_pos = p->audio_buf->pos;
                 p->audio_buf_size = p->audio_buf->size;
-            } else {
-                // errors are treated the same as no buffer ready
-                emit_event(p->eventq, GROOVE_EVENT_BUFFERUNDERRUN);
             }
         }
         if (paused || !p->audio_buf) {
             // fill with silence
+            clock_mark(p, 0);
             memset(stream, 0, len);
+            p->device_time += len / bytes_per_sec;
             break;
         }
+        clock_mark(p, 1);
         size_t len1 = p->audio_buf_size - p->audio_buf_index;
         if (len1 > len)
             len1 = len;
@@ -127,40 +429,201 @@ static void sdl_audio_callback(void *opaque, Uint8 *stream, int len) {
         stream += len1;
         p->audio_buf_index += len1;
         p->play_pos += len1 / bytes_per_sec;
+        p->device_time += len1 / bytes_per_sec;
+    }
+
+    p->clock.limit = p->device_time - p->latency;
+
+    double duration = (monotonic_time() - begin) / (double) MONOTONIC_TIME_FREQUENCY;
+    stats->total_callback_duration += duration;
+    if (duration > stats->max_callback_duration)
+        stats->max_callback_duration = duration;
+
+    publish_clock(p);
+    SDL_SemPost(p->feed_sem);
+}
+
+// stands in for the audio device of the null and file outputs: the device
+// calls back for the next buffer each time it has played the last one
+static void *output_thread(void *arg) {
+    struct GroovePlayerPrivate *p = arg;
+
+    double period = p->output_buf_size / (double) p->sink->bytes_per_sec;
+    double time_period = period / p->output_speed * MONOTONIC_TIME_FREQUENCY;
+    for (int64_t count = 1;; count += 1) {
+        pthread_mutex_lock(&p->output_mutex);
+        if (p->output_abort) {
+            pthread_mutex_unlock(&p->output_mutex);
+            break;
+        }
+        sdl_audio_callback(p, p->output_buf, p->output_buf_size);
+        pthread_mutex_unlock(&p->output_mutex);
+
+        if (p->output_file) {
+            if (fwrite(p->output_buf, 1, p->output_buf_size, p->output_file) !=
+                    (size_t) p->output_buf_size)
+            {
+                av_log(NULL, AV_LOG_ERROR, "unable to write to output file: %s\n",
+                        strerror(errno));
+                fclose(p->output_file);
+                p->output_file = NULL;
+            }
+        }
+
+        // wait for the next deadline rather than for a period, so that
+        // oversleeping does not add up
+        Uint64 deadline = p->output_start + (Uint64)(count * time_period);
+        struct timespec ts;
+        ts.tv_sec = deadline / MONOTONIC_TIME_FREQUENCY;
+        ts.tv_nsec = deadline % MONOTONIC_TIME_FREQUENCY;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
     }
 
-    pthread_mutex_unlock(&p->play_head_mutex);
+    return NULL;
+}
+
+// unref the buffers the audio callback is done with and pass its events on
+static void feed_collect(struct GroovePlayerPrivate *p) {
+    void *item;
+    while (ring_pop(&p->release_ring, &item))
+        groove_buffer_unref(item);
+    while (ring_pop(&p->event_ring, &item))
+        emit_event(p->eventq, (enum GroovePlayerEventType)(intptr_t)item);
+
+    // the audio callback moves on to the next item a device buffer before
+    // the speakers do, so now playing is told by the clock instead
+    struct PlayerClock clock;
+    struct GroovePlaylistItem *heard_item;
+    double pos;
+    read_published(p, &clock, NULL);
+    clock_position(p, &clock, &heard_item, &pos);
+    if (heard_item != p->heard_item) {
+        p->heard_item = heard_item;
+        emit_event(p->eventq, GROOVE_EVENT_NOWPLAYING);
+    }
+}
+
+// this thread does the work of the audio callback that may lock or
+// allocate: taking buffers out of the sink and letting them go again
+static void *feed_thread(void *arg) {
+    struct GroovePlayerPrivate *p = arg;
+
+    pthread_mutex_lock(&p->feed_mutex);
+    while (!p->feed_abort) {
+        feed_collect(p);
+
+        // leave room in release_ring for everything in buffer_ring and the
+        // buffer the audio callback is playing
+        while (ring_count(&p->buffer_ring) + ring_count(&p->release_ring) < PLAYER_RING_SIZE - 1 &&
+                atomic_load(&p->ring_bytes) < p->feed_bytes)
+        {
+            struct GrooveBuffer *buffer;
+            int ret = groove_sink_buffer_get(p->sink, &buffer, 0);
+            if (ret == GROOVE_BUFFER_YES) {
+                atomic_fetch_add(&p->ring_bytes, buffer->size);
+                ring_push(&p->buffer_ring, buffer);
+            } else if (ret == GROOVE_BUFFER_END) {
+                ring_push(&p->buffer_ring, &end_of_playlist);
+            } else {
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&p->feed_mutex);
+        SDL_SemWaitTimeout(p->feed_sem, FEED_POLL_MS);
+        pthread_mutex_lock(&p->feed_mutex);
+    }
+    pthread_mutex_unlock(&p->feed_mutex);
+
+    return NULL;
+}
+
+// let go of the buffered audio of item, or of all of it when item is NULL.
+// the caller takes the place of both ends of buffer_ring, so it must keep
+// feed_thread and the audio callback out
+static void drop_buffered(struct GroovePlayerPrivate *p, struct GroovePlaylistItem *item) {
+    if (p->audio_buf && (!item || p->audio_buf->item == item)) {
+        groove_buffer_unref(p->audio_buf);
+        p->audio_buf = NULL;
+        p->audio_buf_index = 0;
+        p->audio_buf_size = 0;
+    }
+    // keep what does not belong to item, in order
+    int count = ring_count(&p->buffer_ring);
+    for (int i = 0; i < count; i += 1) {
+        void *obj;
+        ring_pop(&p->buffer_ring, &obj);
+        if (obj == &end_of_playlist) {
+            if (item)
+                ring_push(&p->buffer_ring, obj);
+            continue;
+        }
+        struct GrooveBuffer *buffer = obj;
+        if (item && buffer->item != item) {
+            ring_push(&p->buffer_ring, obj);
+            continue;
+        }
+        atomic_fetch_sub(&p->ring_bytes, buffer->size);
+        groove_buffer_unref(buffer);
+    }
 }
 
+static void lock_device(struct GroovePlayerPrivate *p) {
+    if (p->output != GROOVE_PLAYER_OUTPUT_DEVICE)
+        pthread_mutex_lock(&p->output_mutex);
+    else if (p->device_id > 0)
+        SDL_LockAudioDevice(p->device_id);
+}
+
+static void unlock_device(struct GroovePlayerPrivate *p) {
+    if (p->output != GROOVE_PLAYER_OUTPUT_DEVICE)
+        pthread_mutex_unlock(&p->output_mutex);
+    else if (p->device_id > 0)
+        SDL_UnlockAudioDevice(p->device_id);
+}
+
+// purge and flush are rare, so they lock the device for a moment instead
+// of making the audio callback check for them
 static void sink_purge(struct GrooveSink *sink, struct GroovePlaylistItem *item) {
     struct GroovePlayerPrivate *p = sink->userdata;
 
-    pthread_mutex_lock(&p->play_head_mutex);
+    pthread_mutex_lock(&p->feed_mutex);
+    lock_device(p);
 
+    drop_buffered(p, item);
     if (p->play_head == item) {
         p->play_head = NULL;
         p->play_pos = -1.0;
-        groove_buffer_unref(p->audio_buf);
-        p->audio_buf = NULL;
-        p->audio_buf_index = 0;
-        p->audio_buf_size = 0;
+    }
+    // item is about to go away, so the clock must forget it
+    for (int i = 0; i < p->clock.segment_count; i += 1) {
+        struct PlayerSegment *segment = &p->clock.segments[i];
+        if (segment->item == item) {
+            segment->item = NULL;
+            segment->pos = -1.0;
+            segment->playing = 0;
+        }
+    }
+    publish_clock(p);
+    if (p->heard_item == item) {
+        p->heard_item = NULL;
         emit_event(p->eventq, GROOVE_EVENT_NOWPLAYING);
     }
 
-    pthread_mutex_unlock(&p->play_head_mutex);
+    unlock_device(p);
+    pthread_mutex_unlock(&p->feed_mutex);
 }
 
 static void sink_flush(struct GrooveSink *sink) {
     struct GroovePlayerPrivate *p = sink->userdata;
 
-    pthread_mutex_lock(&p->play_head_mutex);
+    pthread_mutex_lock(&p->feed_mutex);
+    lock_device(p);
 
-    groove_buffer_unref(p->audio_buf);
-    p->audio_buf = NULL;
-    p->audio_buf_index = 0;
-    p->audio_buf_size = 0;
+    drop_buffered(p, NULL);
 
-    pthread_mutex_unlock(&p->play_head_mutex);
+    unlock_device(p);
+    pthread_mutex_unlock(&p->feed_mutex);
 }
 
 struct GroovePlayer *groove_player_create(void) {
@@ -171,11 +634,13 @@ struct GroovePlayer *groove_player_create(void) {
         return NULL;
     }
 
-    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
-        av_free(p);
-        av_log(NULL, AV_LOG_ERROR, "unable to init SDL audio subsystem: %s\n",
+    // the null and file outputs do without it, so it may fail on a
+    // machine without sound
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) == 0) {
+        p->sdl_audio_inited = 1;
+    } else {
+        av_log(NULL, AV_LOG_WARNING, "unable to init SDL audio subsystem: %s\n",
                 SDL_GetError());
-        return NULL;
     }
 
     struct GroovePlayer *player = &p->externals;
@@ -191,12 +656,32 @@ struct GroovePlayer *groove_player_create(void) {
     p->sink->purge = sink_purge;
     p->sink->flush = sink_flush;
 
-    if (pthread_mutex_init(&p->play_head_mutex, NULL) != 0) {
+    if (pthread_mutex_init(&p->feed_mutex, NULL) != 0) {
+        groove_player_destroy(player);
+        av_log(NULL, AV_LOG_ERROR,"unable to create feed mutex: out of memory\n");
+        return NULL;
+    }
+    p->feed_mutex_inited = 1;
+
+    if (pthread_mutex_init(&p->output_mutex, NULL) != 0) {
         groove_player_destroy(player);
-        av_log(NULL, AV_LOG_ERROR,"unable to create play head mutex: out of memory\n");
+        av_log(NULL, AV_LOG_ERROR,"unable to create output mutex: out of memory\n");
         return NULL;
     }
-    p->play_head_mutex_inited = 1;
+    p->output_mutex_inited = 1;
+
+    p->feed_sem = SDL_CreateSemaphore(0);
+    if (!p->feed_sem) {
+        groove_player_destroy(player);
+        av_log(NULL, AV_LOG_ERROR,"unable to create feed semaphore: %s\n", SDL_GetError());
+        return NULL;
+    }
+
+    atomic_init(&p->clock_seq, 0);
+    atomic_init(&p->ring_bytes, 0);
+    ring_init(&p->buffer_ring);
+    ring_init(&p->release_ring);
+    ring_init(&p->event_ring);
 
     p->eventq = groove_queue_create();
     if (!p->eventq) {
@@ -212,6 +697,8 @@ struct GroovePlayer *groove_player_create(void) {
     // small because there is no way to clear the buffer.
     player->device_buffer_size = 1024;
     player->sink_buffer_size = 8192;
+    player->output = GROOVE_PLAYER_OUTPUT_DEVICE;
+    player->output_speed = 1.0;
 
     return player;
 }
@@ -220,12 +707,19 @@ void groove_player_destroy(struct GroovePlayer *player) {
     if (!player)
         return;
 
-    SDL_QuitSubSystem(SDL_INIT_AUDIO);
-
     struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
 
-    if (p->play_head_mutex_inited)
-        pthread_mutex_destroy(&p->play_head_mutex);
+    if (p->sdl_audio_inited)
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+
+    if (p->feed_mutex_inited)
+        pthread_mutex_destroy(&p->feed_mutex);
+
+    if (p->output_mutex_inited)
+        pthread_mutex_destroy(&p->output_mutex);
+
+    if (p->feed_sem)
+        SDL_DestroySemaphore(p->feed_sem);
 
     if (p->eventq)
         groove_queue_destroy(p->eventq);
@@ -235,6 +729,99 @@ void groove_player_destroy(struct GroovePlayer *player) {
     av_free(p);
 }
 
+// opens the device, or for the null and file outputs takes the wanted spec
+// as it is
+static int open_output(struct GroovePlayerPrivate *p, SDL_AudioSpec *wanted_spec,
+        SDL_AudioSpec *spec)
+{
+    struct GroovePlayer *player = &p->externals;
+
+    p->output = player->output;
+    switch (p->output) {
+        case GROOVE_PLAYER_OUTPUT_DEVICE:
+            p->device_id = SDL_OpenAudioDevice(player->device_name, 0, wanted_spec,
+                    spec, SDL_AUDIO_ALLOW_ANY_CHANGE);
+            if (p->device_id == 0) {
+                av_log(NULL, AV_LOG_ERROR, "unable to open audio device: %s\n", SDL_GetError());
+                return -1;
+            }
+            return 0;
+        case GROOVE_PLAYER_OUTPUT_NULL:
+            break;
+        case GROOVE_PLAYER_OUTPUT_FILE:
+            if (!player->output_path) {
+                av_log(NULL, AV_LOG_ERROR, "no output path given\n");
+                return -1;
+            }
+            p->output_file = fopen(player->output_path, "wb");
+            if (!p->output_file) {
+                av_log(NULL, AV_LOG_ERROR, "unable to open %s: %s\n",
+                        player->output_path, strerror(errno));
+                return -1;
+            }
+            break;
+        default:
+            av_log(NULL, AV_LOG_ERROR, "invalid output\n");
+            return -1;
+    }
+
+    if (player->output_speed <= 0.0) {
+        av_log(NULL, AV_LOG_ERROR, "invalid output speed\n");
+        return -1;
+    }
+    p->output_speed = player->output_speed;
+
+    *spec = *wanted_spec;
+    spec->size = spec->samples * spec->channels * SDL_AUDIO_BITSIZE(spec->format) / 8;
+    p->output_buf = av_malloc(spec->size);
+    if (!p->output_buf) {
+        av_log(NULL, AV_LOG_ERROR, "unable to create output buffer: out of memory\n");
+        return -1;
+    }
+    p->output_buf_size = spec->size;
+    return 0;
+}
+
+static int start_output(struct GroovePlayerPrivate *p) {
+    if (p->output == GROOVE_PLAYER_OUTPUT_DEVICE) {
+        SDL_PauseAudioDevice(p->device_id, 0);
+        return 0;
+    }
+
+    p->output_abort = 0;
+    p->output_start = monotonic_time();
+    if (pthread_create(&p->output_thread_id, NULL, output_thread, p) != 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to create output thread\n");
+        return -1;
+    }
+    p->output_thread_inited = 1;
+    return 0;
+}
+
+static void close_output(struct GroovePlayerPrivate *p) {
+    if (p->device_id > 0) {
+        SDL_CloseAudioDevice(p->device_id);
+        p->device_id = 0;
+    }
+
+    if (p->output_thread_inited) {
+        pthread_mutex_lock(&p->output_mutex);
+        p->output_abort = 1;
+        pthread_mutex_unlock(&p->output_mutex);
+        pthread_join(p->output_thread_id, NULL);
+        p->output_thread_inited = 0;
+    }
+
+    if (p->output_file) {
+        if (fclose(p->output_file) != 0)
+            av_log(NULL, AV_LOG_ERROR, "unable to write to output file: %s\n", strerror(errno));
+        p->output_file = NULL;
+    }
+
+    av_freep(&p->output_buf);
+    p->output_buf_size = 0;
+}
+
 int groove_player_attach(struct GroovePlayer *player, struct GroovePlaylist *playlist) {
     struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
 
@@ -246,10 +833,8 @@ int groove_player_attach(struct GroovePlayer *player, struct GroovePlaylist *pla
     wanted_spec.callback = sdl_audio_callback;
     wanted_spec.userdata = player;
 
-    p->device_id = SDL_OpenAudioDevice(player->device_name, 0, &wanted_spec,
-            &spec, SDL_AUDIO_ALLOW_ANY_CHANGE);
-    if (p->device_id == 0) {
-        av_log(NULL, AV_LOG_ERROR, "unable to open audio device: %s\n", SDL_GetError());
+    if (open_output(p, &wanted_spec, &spec) < 0) {
+        close_output(p);
         return -1;
     }
 
@@ -275,11 +860,35 @@ int groove_player_attach(struct GroovePlayer *player, struct GroovePlaylist *pla
         return err;
     }
 
+    // the device is paused and output_thread not started, so the audio
+    // callback is not running yet
+    player->actual_device_buffer_size = spec.samples;
+    p->latency = spec.samples / (double) spec.freq;
+    p->play_head = NULL;
     p->play_pos = -1.0;
+    p->device_time = 0.0;
+    memset(&p->clock, 0, sizeof(struct PlayerClock));
+    memset(&p->stats, 0, sizeof(struct PlayerStats));
+    publish_clock(p);
+    p->heard_item = NULL;
 
     groove_queue_reset(p->eventq);
 
-    SDL_PauseAudioDevice(p->device_id, 0);
+    int bytes_per_frame = groove_channel_layout_count(p->sink->audio_format.channel_layout) *
+        groove_sample_format_bytes_per_sample(p->sink->audio_format.sample_fmt);
+    p->feed_bytes = FEED_DEVICE_BUFFERS * spec.samples * bytes_per_frame;
+    p->feed_abort = 0;
+    if (pthread_create(&p->feed_thread_id, NULL, feed_thread, p) != 0) {
+        groove_player_detach(player);
+        av_log(NULL, AV_LOG_ERROR, "unable to create feed thread\n");
+        return -1;
+    }
+    p->feed_thread_inited = 1;
+
+    if (start_output(p) < 0) {
+        groove_player_detach(player);
+        return -1;
+    }
 
     return 0;
 }
@@ -293,14 +902,27 @@ int groove_player_detach(struct GroovePlayer *player) {
     if (p->sink->playlist) {
         groove_sink_detach(p->sink);
     }
-    if (p->device_id > 0) {
-        SDL_CloseAudioDevice(p->device_id);
-        p->device_id = 0;
-    }
+    close_output(p);
     player->playlist = NULL;
 
-    groove_buffer_unref(p->audio_buf);
-    p->audio_buf = NULL;
+    if (p->feed_thread_inited) {
+        pthread_mutex_lock(&p->feed_mutex);
+        p->feed_abort = 1;
+        pthread_mutex_unlock(&p->feed_mutex);
+        SDL_SemPost(p->feed_sem);
+        pthread_join(p->feed_thread_id, NULL);
+        p->feed_thread_inited = 0;
+    }
+
+    // with the device closed nothing else touches the rings
+    drop_buffered(p, NULL);
+    void *item;
+    while (ring_pop(&p->release_ring, &item))
+        groove_buffer_unref(item);
+    while (ring_pop(&p->event_ring, &item)) {}
+    p->latency = 0.0;
+    if (p->eventq)
+        groove_queue_flush(p->eventq);
 
     return 0;
 }
@@ -318,15 +940,39 @@ void groove_player_position(struct GroovePlayer *player,
 {
     struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
 
-    pthread_mutex_lock(&p->play_head_mutex);
+    struct PlayerClock clock;
+    struct GroovePlaylistItem *play_head;
+    double play_pos;
+    read_published(p, &clock, NULL);
+    clock_position(p, &clock, &play_head, &play_pos);
 
     if (item)
-        *item = p->play_head;
+        *item = play_head;
 
     if (seconds)
-        *seconds = p->play_pos;
+        *seconds = play_pos;
+}
+
+double groove_player_latency(struct GroovePlayer *player) {
+    struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
+    return p->latency;
+}
+
+void groove_player_stats(struct GroovePlayer *player, struct GroovePlayerStats *stats) {
+    struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
 
-    pthread_mutex_unlock(&p->play_head_mutex);
+    struct PlayerStats totals;
+    read_published(p, NULL, &totals);
+
+    stats->callback_count = totals.callback_count;
+    stats->underrun_count = totals.underrun_count;
+    stats->max_jitter = totals.max_jitter;
+    // there is no interval before the first callback
+    stats->mean_jitter = totals.callback_count > 1 ?
+        totals.total_jitter / (totals.callback_count - 1) : 0.0;
+    stats->max_callback_duration = totals.max_callback_duration;
+    stats->mean_callback_duration = totals.callback_count > 0 ?
+        totals.total_callback_duration / totals.callback_count : 0.0;
 }
 
 int groove_player_event_get(struct GroovePlayer *player,
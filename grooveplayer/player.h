@@ -29,6 +29,42 @@ union GroovePlayerEvent {
     enum GroovePlayerEventType type;
 };
 
+/* where a player sends the audio */
+enum GroovePlayerOutput {
+    /* the audio device named by device_name */
+    GROOVE_PLAYER_OUTPUT_DEVICE,
+
+    /* nowhere. a timer thread takes the audio the way a device with the
+     * same format and buffer size would, at output_speed. needs no sound
+     * hardware.
+     */
+    GROOVE_PLAYER_OUTPUT_NULL,
+
+    /* like GROOVE_PLAYER_OUTPUT_NULL, and writes the audio as raw PCM in
+     * actual_audio_format to output_path, which may be a named pipe
+     */
+    GROOVE_PLAYER_OUTPUT_FILE
+};
+
+/* how the audio callback has been doing since the player was attached */
+struct GroovePlayerStats {
+    /* how many times the audio callback ran */
+    int callback_count;
+    /* how many times it had no audio to give the device */
+    int underrun_count;
+
+    /* how far the time between two callbacks was off from the device
+     * buffer length, in seconds. for the null and file outputs the time is
+     * sped up by output_speed.
+     */
+    double max_jitter;
+    double mean_jitter;
+
+    /* how long the audio callback took, in seconds */
+    double max_callback_duration;
+    double mean_callback_duration;
+};
+
 struct GroovePlayer {
     /* set this to the device you want to open
      * NULL means default device
@@ -46,6 +82,8 @@ struct GroovePlayer {
     /* how big the device buffer should be, in sample frames.
      * must be a power of 2.
      * groove_player_create defaults this to 1024
+     * a bigger buffer costs less CPU. groove_player_position makes up for
+     * the latency it adds.
      */
     int device_buffer_size;
 
@@ -63,6 +101,25 @@ struct GroovePlayer {
      * ideally will be the same as target_audio_format but might not be.
      */
     struct GrooveAudioFormat actual_audio_format;
+
+    /* read-only. set to the actual device buffer size you get when you
+     * open the device, in sample frames. might not be device_buffer_size.
+     */
+    int actual_device_buffer_size;
+
+    /* where to send the audio.
+     * groove_player_create defaults this to GROOVE_PLAYER_OUTPUT_DEVICE
+     */
+    enum GroovePlayerOutput output;
+
+    /* the file that GROOVE_PLAYER_OUTPUT_FILE writes to */
+    char *output_path;
+
+    /* how many seconds of audio the null and file outputs play per second.
+     * more than 1 is faster than real time.
+     * groove_player_create defaults this to 1
+     */
+    double output_speed;
 };
 
 /* Returns the number of available devices exposed by the current driver or -1
@@ -102,10 +159,22 @@ int groove_player_detach(struct GroovePlayer *player);
  * both the current playlist item and the position in seconds in the playlist
  * item are given. item will be set to NULL if the playlist is empty
  * you may pass NULL for item or seconds
+ * this is the audio coming out of the speakers: it allows for the device
+ * buffer and moves on smoothly between audio callbacks. it does not go
+ * backwards unless you seek.
  */
 void groove_player_position(struct GroovePlayer *player,
         struct GroovePlaylistItem **item, double *seconds);
 
+/* returns the estimated seconds it takes audio to get from the sink to the
+ * speakers, which groove_player_position already allows for. 0 if the
+ * player is not attached.
+ */
+double groove_player_latency(struct GroovePlayer *player);
+
+/* fills stats with how the audio callback has been doing */
+void groove_player_stats(struct GroovePlayer *player, struct GroovePlayerStats *stats);
+
 /* returns < 0 on error, 0 on no event ready, 1 on got event */
 int groove_player_event_get(struct GroovePlayer *player,
         union GroovePlayerEvent *event, int block);